@@ -0,0 +1,130 @@
+#pragma once
+
+#include <coroutine>
+#include <deque>       // For the waiting consumers
+#include <functional>  // For the executor
+
+#include "prqueue.h"
+
+/// A `prqueue` for C++20 coroutine consumers on a single-threaded event loop.
+///
+/// `co_await q.dequeue()` returns the value with the smallest priority, and
+/// suspends the consumer while the queue is empty. Each `enqueue` resumes
+/// exactly one waiting consumer, in the order they started waiting. The
+/// resumed consumer takes the smallest value at the time it runs, so values
+/// enqueued before it runs are still handed out in priority order.
+///
+/// Consumers are resumed through the executor given to the constructor,
+/// which must run them on the same thread as every other call; there is no
+/// locking.
+template <typename T>
+class async_prqueue {
+   public:
+    class dequeue_awaiter;
+
+   private:
+    prqueue<T> items;
+    deque<dequeue_awaiter*> waiters;
+    function<void(coroutine_handle<>)> executor;
+
+    // Number of values promised to consumers that have been scheduled but
+    // have not run yet. Those values are not handed to anyone else.
+    size_t reserved;
+
+   public:
+    /// Awaitable returned by `dequeue`.
+    class dequeue_awaiter {
+       private:
+        friend class async_prqueue;
+
+        async_prqueue* queue;
+        coroutine_handle<> handle;
+
+       public:
+        explicit dequeue_awaiter(async_prqueue* q) : queue(q) {}
+
+        bool await_ready() const noexcept {
+            return queue->items.size() > queue->reserved;
+        }
+
+        void await_suspend(coroutine_handle<> h) {
+            handle = h;
+            queue->waiters.push_back(this);
+        }
+
+        T await_resume() {
+            if (handle) {
+                queue->reserved--;
+            }
+            return queue->items.dequeue();
+        }
+    };
+
+    /// Creates an empty `async_prqueue` that resumes consumers by passing
+    /// them to `executor`. Without an executor, consumers are resumed inline
+    /// from `enqueue`.
+    /// Runs in O(1).
+    explicit async_prqueue(function<void(coroutine_handle<>)> executor = nullptr) : executor(std::move(executor)) {
+        reserved = 0;
+    }
+
+    async_prqueue(const async_prqueue&) = delete;
+    async_prqueue& operator=(const async_prqueue&) = delete;
+
+    /// Adds `value` with the given `priority`, and resumes the consumer that
+    /// has been waiting longest, if any.
+    ///
+    /// Runs in O(H + M), where H is the height of the tree, and M is
+    /// the number of duplicate priorities.
+    void enqueue(T value, int priority) {
+        items.enqueue(value, priority);
+        if (waiters.empty()) {
+            return;
+        }
+
+        dequeue_awaiter* waiter = waiters.front();
+        waiters.pop_front();
+        reserved++;
+        if (executor) {
+            executor(waiter->handle);
+        }
+        else {
+            waiter->handle.resume();
+        }
+    }
+
+    /// Returns an awaitable for the value with the smallest priority. The
+    /// awaiting coroutine is suspended until a value is available.
+    ///
+    /// Runs in O(H + M) once a value is available.
+    dequeue_awaiter dequeue() {
+        return dequeue_awaiter(this);
+    }
+
+    /// Removes the value with the smallest priority into `value` without
+    /// suspending. Returns false if no value is available to this caller.
+    ///
+    /// Runs in O(H + M).
+    bool try_dequeue(T& value) {
+        if (items.size() <= reserved) {
+            return false;
+        }
+        value = items.dequeue();
+        return true;
+    }
+
+    /// Returns the number of values in the queue, including values promised
+    /// to resumed consumers that have not run yet.
+    ///
+    /// Runs in O(1).
+    size_t size() const {
+        return items.size();
+    }
+
+    /// Returns the number of suspended consumers.
+    ///
+    /// Runs in O(1).
+    size_t waiting() const {
+        return waiters.size();
+    }
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>  // For stable_sort and min
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>    // For SIZE_MAX
+#include <mutex>
+#include <utility>    // For pair
+#include <vector>
+
+#include "prqueue.h"
+
+/// A thread-safe, optionally bounded `prqueue` for producer and consumer
+/// threads.
+///
+/// `push` blocks while the queue is full, and `pop` blocks while it is
+/// empty. `push_batch` and `pop_batch` take the lock once per batch, apply
+/// it with a single walk of the tree (see `prqueue::enqueue_batch` and
+/// `prqueue::dequeue_batch`), and wake waiting threads once per batch
+/// instead of once per value.
+template <typename T>
+class blocking_prqueue {
+   private:
+    prqueue<T> items;
+    size_t cap;  // 0 means unbounded
+
+    mutable mutex lock;
+    condition_variable notEmpty;
+    condition_variable notFull;
+
+    // Returns how many more values fit. Must hold `lock`.
+    size_t room() const {
+        return cap == 0 ? SIZE_MAX : cap - items.size();
+    }
+
+   public:
+    /// Creates an empty `blocking_prqueue` that holds at most `capacity`
+    /// values, or any number of values if `capacity` is 0.
+    /// Runs in O(1).
+    explicit blocking_prqueue(size_t capacity = 0) {
+        cap = capacity;
+    }
+
+    blocking_prqueue(const blocking_prqueue&) = delete;
+    blocking_prqueue& operator=(const blocking_prqueue&) = delete;
+
+    /// Adds `value` with the given `priority`, waiting while the queue is
+    /// full, and wakes one waiting consumer.
+    ///
+    /// Runs in O(H + M) once there is room, where H is the height of the
+    /// tree, and M is the number of duplicate priorities.
+    void push(T value, int priority) {
+        unique_lock<mutex> guard(lock);
+        notFull.wait(guard, [this] { return room() > 0; });
+        items.enqueue(value, priority);
+        guard.unlock();
+        notEmpty.notify_one();
+    }
+
+    /// Adds every value-priority pair in `batch`, waiting while the queue is
+    /// full. If the batch does not fit, it is added in chunks as consumers
+    /// make room, with the smallest priorities first.
+    ///
+    /// Runs in O(K log K + V) once there is room; see
+    /// `prqueue::enqueue_batch`.
+    void push_batch(vector<pair<T, int>> batch) {
+        if (batch.size() > 1 && cap != 0) {
+            stable_sort(batch.begin(), batch.end(), [](const pair<T, int>& a, const pair<T, int>& b) {
+                return a.second < b.second;
+            });
+        }
+
+        size_t done = 0;
+        while (done < batch.size()) {
+            unique_lock<mutex> guard(lock);
+            notFull.wait(guard, [this] { return room() > 0; });
+
+            size_t count = min(room(), batch.size() - done);
+            if (done == 0 && count == batch.size()) {
+                items.enqueue_batch(std::move(batch));
+            }
+            else {
+                items.enqueue_batch(vector<pair<T, int>>(batch.begin() + done, batch.begin() + done + count));
+            }
+            done += count;
+
+            guard.unlock();
+            notEmpty.notify_all();
+        }
+    }
+
+    /// Returns the value with the smallest priority and removes it, waiting
+    /// while the queue is empty.
+    ///
+    /// Runs in O(H + M) once a value is available.
+    T pop() {
+        unique_lock<mutex> guard(lock);
+        notEmpty.wait(guard, [this] { return items.size() > 0; });
+        T result = items.dequeue();
+        guard.unlock();
+        notFull.notify_one();
+        return result;
+    }
+
+    /// Removes the value with the smallest priority into `value`, waiting up
+    /// to `timeout` for one to arrive. Returns false if the queue was still
+    /// empty when the timeout expired.
+    ///
+    /// Runs in O(H + M) once a value is available.
+    template <typename Rep, typename Period>
+    bool try_pop_for(T& value, const chrono::duration<Rep, Period>& timeout) {
+        unique_lock<mutex> guard(lock);
+        if (!notEmpty.wait_for(guard, timeout, [this] { return items.size() > 0; })) {
+            return false;
+        }
+        value = items.dequeue();
+        guard.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    /// Removes up to `count` values with the smallest priorities, appending
+    /// them to `out` in priority order, and waits while the queue is empty.
+    /// Returns the number of values removed, which is at least 1 unless
+    /// `count` is 0.
+    ///
+    /// Runs in O(K + H + M) once a value is available; see
+    /// `prqueue::dequeue_batch`.
+    size_t pop_batch(size_t count, vector<T>& out) {
+        if (count == 0) {
+            return 0;
+        }
+        unique_lock<mutex> guard(lock);
+        notEmpty.wait(guard, [this] { return items.size() > 0; });
+        size_t taken = items.dequeue_batch(count, out);
+        guard.unlock();
+        notFull.notify_all();
+        return taken;
+    }
+
+    /// Returns the number of values in the queue.
+    ///
+    /// Runs in O(1).
+    size_t size() const {
+        lock_guard<mutex> guard(lock);
+        return items.size();
+    }
+
+    /// Returns the maximum number of values the queue holds, or 0 if it is
+    /// unbounded.
+    ///
+    /// Runs in O(1).
+    size_t capacity() const {
+        return cap;
+    }
+};
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <algorithm>  // For max
+#include <cstdint>
+#include <sstream>    // For as_string
+#include <utility>    // For pair
+#include <vector>
+
+using namespace std;
+
+/// A memory-compact version of `prqueue`.
+///
+/// Tree nodes live in one contiguous vector and refer to each other by
+/// 32-bit indices instead of pointers. There is no parent link: operations
+/// that need one track it on the way down. Duplicates of a priority live in
+/// a second vector, as just a value and a 32-bit index to the next one.
+///
+/// For `compact_prqueue<int>` a tree node takes 20 bytes and a duplicate
+/// takes 8, against 64 and 40 bytes in an unbounded `prqueue<int>`, whose
+/// duplicates also take 64 bytes while it is bounded. Each vector holds up
+/// to 2^32 - 1 entries. Freed slots are reused before either vector grows.
+///
+/// Like `prqueue`, the tree is an unbalanced binary search tree, but it is
+/// never rebalanced, so a long run of increasing priorities leaves a right
+/// spine as deep as the run.
+template <typename T>
+class compact_prqueue {
+   private:
+    static const uint32_t NIL = UINT32_MAX;
+
+    struct NODE {
+        T value;
+        int priority;
+        uint32_t left;   // Also links free slots
+        uint32_t right;
+        uint32_t link;   // First duplicate, in `dups`
+    };
+
+    struct DUP {
+        T value;
+        uint32_t next;   // Also links free slots
+    };
+
+    vector<NODE> nodes;
+    vector<DUP> dups;
+    uint32_t root;
+    uint32_t freeNodes;
+    uint32_t freeDups;
+    size_t sz;
+
+    // Utility state for begin and next.
+    vector<uint32_t> stack;
+    uint32_t chain;
+    int chainPriority;
+
+    // Returns NIL, allocating nothing, if every index is taken.
+    uint32_t allocNode(const T& value, int priority) {
+        uint32_t index = freeNodes;
+        if (index != NIL) {
+            freeNodes = nodes[index].left;
+            nodes[index] = NODE{value, priority, NIL, NIL, NIL};
+        }
+        else if (nodes.size() >= NIL) {
+            return NIL;
+        }
+        else {
+            index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(NODE{value, priority, NIL, NIL, NIL});
+        }
+        return index;
+    }
+
+    // Returns NIL, allocating nothing, if every index is taken.
+    uint32_t allocDup(const T& value) {
+        uint32_t index = freeDups;
+        if (index != NIL) {
+            freeDups = dups[index].next;
+            dups[index] = DUP{value, NIL};
+        }
+        else if (dups.size() >= NIL) {
+            return NIL;
+        }
+        else {
+            index = static_cast<uint32_t>(dups.size());
+            dups.push_back(DUP{value, NIL});
+        }
+        return index;
+    }
+
+    void freeNode(uint32_t index) {
+        nodes[index].left = freeNodes;
+        freeNodes = index;
+    }
+
+    void freeDup(uint32_t index) {
+        dups[index].next = freeDups;
+        freeDups = index;
+    }
+
+    void pushLeft(uint32_t index) {
+        while (index != NIL) {
+            stack.push_back(index);
+            index = nodes[index].left;
+        }
+    }
+
+   public:
+    /// Creates an empty `compact_prqueue`.
+    /// Runs in O(1).
+    compact_prqueue() {
+        root = NIL;
+        freeNodes = NIL;
+        freeDups = NIL;
+        sz = 0;
+        chain = NIL;
+        chainPriority = 0;
+    }
+
+    /// Empties the `compact_prqueue`, freeing all memory it controls.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    void clear() {
+        nodes.clear();
+        nodes.shrink_to_fit();
+        dups.clear();
+        dups.shrink_to_fit();
+        stack.clear();
+        root = NIL;
+        freeNodes = NIL;
+        freeDups = NIL;
+        sz = 0;
+        chain = NIL;
+    }
+
+    /// Adds `value` to the `compact_prqueue` with the given `priority`.
+    ///
+    /// Returns false, without adding the value, if it needs a new tree node
+    /// or duplicate and that vector already holds 2^32 - 1 entries.
+    ///
+    /// Runs in O(H + M), where H is the height of the tree, and M is
+    /// the number of duplicate priorities.
+    bool enqueue(T value, int priority) {
+        if (root == NIL) {
+            root = allocNode(value, priority);
+            sz += (root != NIL);
+            return root != NIL;
+        }
+
+        // Indices stay valid when the vectors grow, references do not
+        uint32_t current = root;
+        while (true) {
+            if (priority == nodes[current].priority) {
+                uint32_t newDup = allocDup(value);
+                if (newDup == NIL) {
+                    return false;
+                }
+                sz++;
+                if (nodes[current].link == NIL) {
+                    nodes[current].link = newDup;
+                    return true;
+                }
+                uint32_t tail = nodes[current].link;
+                while (dups[tail].next != NIL) {
+                    tail = dups[tail].next;
+                }
+                dups[tail].next = newDup;
+                return true;
+            }
+            else if (priority < nodes[current].priority) {
+                if (nodes[current].left == NIL) {
+                    uint32_t newNode = allocNode(value, priority);
+                    if (newNode == NIL) {
+                        return false;
+                    }
+                    nodes[current].left = newNode;
+                    sz++;
+                    return true;
+                }
+                current = nodes[current].left;
+            }
+            else {
+                if (nodes[current].right == NIL) {
+                    uint32_t newNode = allocNode(value, priority);
+                    if (newNode == NIL) {
+                        return false;
+                    }
+                    nodes[current].right = newNode;
+                    sz++;
+                    return true;
+                }
+                current = nodes[current].right;
+            }
+        }
+    }
+
+    /// Returns the value with the smallest priority in the
+    /// `compact_prqueue`, but does not modify it.
+    ///
+    /// If the `compact_prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in O(H), where H is the height of the tree.
+    T peek() const {
+        if (root == NIL) {
+            return T{};
+        }
+        uint32_t current = root;
+        while (nodes[current].left != NIL) {
+            current = nodes[current].left;
+        }
+        return nodes[current].value;
+    }
+
+    /// Returns the value with the smallest priority in the
+    /// `compact_prqueue` and removes it.
+    ///
+    /// If the `compact_prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in O(H), where H is the height of the tree.
+    T dequeue() {
+        if (root == NIL) {
+            return T();
+        }
+
+        uint32_t parent = NIL;
+        uint32_t current = root;
+        while (nodes[current].left != NIL) {
+            parent = current;
+            current = nodes[current].left;
+        }
+
+        NODE& node = nodes[current];
+        T result = std::move(node.value);
+
+        // If has dupes, the first one takes the node's place
+        if (node.link != NIL) {
+            uint32_t first = node.link;
+            node.value = std::move(dups[first].value);
+            node.link = dups[first].next;
+            freeDup(first);
+        }
+        else {
+            if (parent == NIL) {
+                root = node.right;
+            }
+            else {
+                nodes[parent].left = node.right;
+            }
+            freeNode(current);
+        }
+        sz--;
+        return result;
+    }
+
+    /// Returns the number of elements in the `compact_prqueue`.
+    ///
+    /// Runs in O(1).
+    size_t size() const {
+        return sz;
+    }
+
+    /// Returns the height of the tree: the number of nodes on its longest
+    /// path from the root, not counting duplicates.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    size_t height() const {
+        size_t best = 0;
+        vector<pair<uint32_t, size_t>> pending;
+        if (root != NIL) {
+            pending.push_back({root, 1});
+        }
+        while (!pending.empty()) {
+            auto [index, depth] = pending.back();
+            pending.pop_back();
+            best = max(best, depth);
+            if (nodes[index].left != NIL) {
+                pending.push_back({nodes[index].left, depth + 1});
+            }
+            if (nodes[index].right != NIL) {
+                pending.push_back({nodes[index].right, depth + 1});
+            }
+        }
+        return best;
+    }
+
+    /// Returns the number of bytes held by the node storage, including
+    /// freed slots waiting for reuse.
+    ///
+    /// Runs in O(1).
+    size_t memory_bytes() const {
+        return nodes.capacity() * sizeof(NODE) + dups.capacity() * sizeof(DUP);
+    }
+
+    /// Resets internal state for an iterative inorder traversal.
+    ///
+    /// See `next` for usage details.
+    ///
+    /// O(H), where H is the maximum height of the tree.
+    void begin() {
+        stack.clear();
+        chain = NIL;
+        pushLeft(root);
+    }
+
+    /// Uses the internal state to return the next in-order value and priority
+    /// by reference, and advances the internal state. Returns true if the
+    /// reference parameters were set, and false otherwise.
+    ///
+    /// Runs in amortized O(1), and worst-case O(H).
+    bool next(T& value, int& priority) {
+        if (chain != NIL) {
+            value = dups[chain].value;
+            priority = chainPriority;
+            chain = dups[chain].next;
+            return true;
+        }
+        if (stack.empty()) {
+            return false;
+        }
+
+        uint32_t index = stack.back();
+        stack.pop_back();
+        value = nodes[index].value;
+        priority = nodes[index].priority;
+        chain = nodes[index].link;
+        chainPriority = priority;
+        pushLeft(nodes[index].right);
+        return true;
+    }
+
+    /// Converts the `compact_prqueue` to a string representation, with the
+    /// values in-order by priority, in the same format as `prqueue`.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    string as_string() const {
+        ostringstream output;
+        vector<uint32_t> pending;
+        uint32_t index = root;
+        while (index != NIL || !pending.empty()) {
+            while (index != NIL) {
+                pending.push_back(index);
+                index = nodes[index].left;
+            }
+            index = pending.back();
+            pending.pop_back();
+
+            const NODE& node = nodes[index];
+            output << node.priority << " value: " << node.value << endl;
+            for (uint32_t dup = node.link; dup != NIL; dup = dups[dup].next) {
+                output << node.priority << " value: " << dups[dup].value << endl;
+            }
+            index = node.right;
+        }
+        return output.str();
+    }
+};
@@ -0,0 +1,413 @@
+#pragma once
+
+#include <algorithm>    // For push_heap, pop_heap and remove_if
+#include <climits>      // For INT_MIN
+#include <cstdio>       // For remove
+#include <cstdlib>      // For mkstemp
+#include <fstream>
+#include <memory>       // For unique_ptr
+#include <string>
+#include <type_traits>  // For is_trivially_copyable_v
+#include <unistd.h>     // For close
+#include <utility>      // For pair
+#include <vector>
+
+#include "prqueue.h"
+
+/// A `prqueue` that holds at most a fixed number of values in memory and
+/// spills the rest to files in a local directory.
+///
+/// New values go into an in-memory `prqueue`. When it holds `budget`
+/// values, the half with the largest priorities is split off and written to
+/// a new run file, sorted by priority. When the smallest value left is on
+/// disk, the buffer is refilled with the smallest values across all runs,
+/// read by a k-way merge of the run files.
+///
+/// Runs are merged in levels: a spilled run is on level 0, and once 16 runs
+/// share a level, they are merged into one run on the next level. Each
+/// value is rewritten once per level, O(log(N / B)) times for N values and
+/// a budget of B, and at most 15 runs per level stay open.
+///
+/// A run file holds its values back to back, each as the `int` priority
+/// followed by the bytes of the `T`, so `T` must be trivially copyable.
+/// Run files are removed once read, and by `clear` and the destructor. If a
+/// run file cannot be read back, its unread values are dropped and counted
+/// by `lost`.
+///
+/// Values with equal priorities may come out in a different order than
+/// they were added once they have been spilled.
+template <typename T>
+class external_prqueue {
+    static_assert(is_trivially_copyable_v<T>, "values are written to disk byte for byte");
+
+   private:
+    static const size_t FAN_IN = 16;
+    static const size_t RECORD = sizeof(int) + sizeof(T);
+
+    struct RUN {
+        string path;
+        ifstream in;
+        size_t count;      // Values in the file
+        size_t remaining;  // Values not yet read, besides the head
+        size_t level;      // Merges the values have been through
+        int priority;      // Head, the smallest value not yet taken
+        T value;
+    };
+
+    prqueue<T> buffer;
+    string dir;
+    size_t limit;
+    size_t diskSize;
+    size_t lostCount;
+
+    // Run files, kept as a heap with the smallest head in front.
+    vector<unique_ptr<RUN>> runs;
+
+    static bool laterHead(const unique_ptr<RUN>& a, const unique_ptr<RUN>& b) {
+        return a->priority > b->priority;
+    }
+
+    // Reads the next head of a run. Returns false at the end of the run, or
+    // if the read failed, leaving `remaining` as the values not read.
+    static bool readHead(RUN& run) {
+        if (run.remaining == 0) {
+            return false;
+        }
+        run.in.read(reinterpret_cast<char*>(&run.priority), sizeof(int));
+        run.in.read(reinterpret_cast<char*>(&run.value), sizeof(T));
+        if (!run.in) {
+            return false;
+        }
+        run.remaining--;
+        return true;
+    }
+
+    static void writeRecord(ofstream& out, const T& value, int priority) {
+        out.write(reinterpret_cast<const char*>(&priority), sizeof(int));
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    // Creates an empty file with a name no other file in `dir` has, even
+    // one from another process, and returns its path. Returns an empty
+    // path, which cannot be opened, if no file can be created.
+    string newPath() const {
+        string path = dir + "/prqueue-XXXXXX";
+        int fd = mkstemp(path.data());
+        if (fd < 0) {
+            return "";
+        }
+        close(fd);
+        return path;
+    }
+
+    // Opens a finished run file of `count` values. Returns null, leaving the
+    // file in place, if its first value cannot be read.
+    static unique_ptr<RUN> openRun(const string& path, size_t count, size_t level) {
+        unique_ptr<RUN> run(new RUN);
+        run->path = path;
+        run->in.open(path, ios::binary);
+        run->count = count;
+        run->remaining = count;
+        run->level = level;
+        if (!readHead(*run)) {
+            return nullptr;
+        }
+        return run;
+    }
+
+    // Adds an opened run to the heap.
+    void addRun(unique_ptr<RUN> run) {
+        diskSize += run->count;
+        runs.push_back(std::move(run));
+        push_heap(runs.begin(), runs.end(), laterHead);
+    }
+
+    // Removes the smallest value on disk, deleting its run once read. A run
+    // that cannot be read further is deleted too, and its unread values are
+    // counted as lost.
+    void popDisk(T& value, int& priority) {
+        pop_heap(runs.begin(), runs.end(), laterHead);
+        RUN& run = *runs.back();
+        value = run.value;
+        priority = run.priority;
+        diskSize--;
+        if (readHead(run)) {
+            push_heap(runs.begin(), runs.end(), laterHead);
+        }
+        else {
+            diskSize -= run.remaining;
+            lostCount += run.remaining;
+            run.in.close();
+            remove(run.path.c_str());
+            runs.pop_back();
+        }
+    }
+
+    // Writes the half of the buffer with the largest priorities to a new
+    // run. Returns false, leaving the buffer unchanged, if writing failed.
+    //
+    // While the upper half is copied out of its tree, both copies are in
+    // memory, so a spill briefly holds about half the budget more than it.
+    bool spill() {
+        int priority = 0;
+        T value;
+        auto cursor = buffer.peek_view();
+        for (size_t i = 0; i <= buffer.size() / 2; i++) {
+            cursor.next(value, priority);
+        }
+
+        // If the median is the largest priority, its whole class goes
+        prqueue<T> upper = buffer.split(priority);
+        if (upper.size() == 0 && priority > INT_MIN) {
+            upper = buffer.split(priority - 1);
+        }
+        else if (upper.size() == 0) {
+            upper = std::move(buffer);
+        }
+        vector<pair<T, int>> items = std::move(upper).to_vector();
+
+        string path = newPath();
+        ofstream out(path, ios::binary);
+        for (auto& item : items) {
+            writeRecord(out, item.first, item.second);
+        }
+        out.close();
+        unique_ptr<RUN> run;
+        if (out) {
+            run = openRun(path, items.size(), 0);
+        }
+        if (!run) {
+            remove(path.c_str());
+            buffer.enqueue_batch(std::move(items));
+            return false;
+        }
+        addRun(std::move(run));
+        for (size_t level = 0; mergeLevel(level); level++) {
+        }
+        return true;
+    }
+
+    // Merges the runs on `level` into one run on the next level, if there
+    // are `FAN_IN` of them. Returns true if they were merged.
+    //
+    // The old runs are only removed once the merged run has been written and
+    // read back; otherwise they are rewound and kept as they were.
+    bool mergeLevel(size_t level) {
+        vector<RUN*> group;
+        vector<size_t> saved;
+        size_t count = 0;
+        for (auto& run : runs) {
+            if (run->level == level) {
+                group.push_back(run.get());
+                saved.push_back(run->remaining);
+                count += run->remaining + 1;
+            }
+        }
+        if (group.size() < FAN_IN) {
+            return false;
+        }
+        auto later = [](const RUN* a, const RUN* b) { return a->priority > b->priority; };
+
+        vector<RUN*> heap = group;
+        make_heap(heap.begin(), heap.end(), later);
+        string path = newPath();
+        ofstream out(path, ios::binary);
+        size_t written = 0;
+        while (!heap.empty() && out) {
+            pop_heap(heap.begin(), heap.end(), later);
+            RUN* run = heap.back();
+            writeRecord(out, run->value, run->priority);
+            written++;
+            if (readHead(*run)) {
+                push_heap(heap.begin(), heap.end(), later);
+            }
+            else {
+                heap.pop_back();
+            }
+        }
+        out.close();
+        unique_ptr<RUN> merged;
+        if (out) {
+            merged = openRun(path, written, level + 1);
+        }
+
+        if (!merged) {
+            // Rewind every run to the head it had
+            remove(path.c_str());
+            for (size_t i = 0; i < group.size(); i++) {
+                RUN& run = *group[i];
+                run.in.clear();
+                run.in.seekg((run.count - saved[i] - 1) * RECORD);
+                run.remaining = saved[i] + 1;
+                readHead(run);
+            }
+            return false;
+        }
+
+        // Values that could not be read back were left out of the merge
+        diskSize -= count - written;
+        lostCount += count - written;
+        for (RUN* run : group) {
+            run->in.close();
+            remove(run->path.c_str());
+        }
+        runs.erase(remove_if(runs.begin(), runs.end(),
+                             [level](const unique_ptr<RUN>& run) { return run->level == level; }),
+                   runs.end());
+        runs.push_back(std::move(merged));
+        make_heap(runs.begin(), runs.end(), laterHead);
+        return true;
+    }
+
+    // Moves the smallest values on disk into the buffer, filling at most
+    // half of it, and never past the budget.
+    void refill() {
+        size_t room = min(limit / 2, limit - buffer.size());
+        vector<pair<T, int>> items;
+        T value;
+        int priority;
+        while (items.size() < room && !runs.empty()) {
+            popDisk(value, priority);
+            items.push_back({value, priority});
+        }
+        buffer.enqueue_batch(std::move(items));
+    }
+
+    // Returns true if the smallest value is on disk.
+    bool diskFirst() const {
+        if (runs.empty()) {
+            return false;
+        }
+        T value;
+        int priority;
+        return !buffer.peek(value, priority) || runs.front()->priority < priority;
+    }
+
+   public:
+    /// Creates an empty `external_prqueue` that keeps at most `budget`
+    /// values in memory, and writes its run files to `directory`, which
+    /// must exist.
+    ///
+    /// Besides the values, each open run file holds a stream buffer.
+    ///
+    /// Runs in O(1).
+    external_prqueue(const string& directory, size_t budget) {
+        dir = directory;
+        limit = max<size_t>(budget, 2);
+        diskSize = 0;
+        lostCount = 0;
+    }
+
+    external_prqueue(const external_prqueue&) = delete;
+    external_prqueue& operator=(const external_prqueue&) = delete;
+
+    /// Empties the `external_prqueue`, freeing its memory and removing its
+    /// run files.
+    ///
+    /// Runs in O(N + R), where N is the number of values in memory, and R is
+    /// the number of run files.
+    void clear() {
+        buffer.clear();
+        for (auto& run : runs) {
+            run->in.close();
+            remove(run->path.c_str());
+        }
+        runs.clear();
+        diskSize = 0;
+    }
+
+    /// Destructor, removes the run files.
+    ~external_prqueue() {
+        clear();
+    }
+
+    /// Adds `value` to the `external_prqueue` with the given `priority`.
+    ///
+    /// If the memory budget is used up, half of the values in memory are
+    /// spilled to a new run file first. Returns false, without adding the
+    /// value, if that fails.
+    ///
+    /// Runs in O(H + M) when nothing is spilled, where H is the height of
+    /// the in-memory tree, and M is the number of duplicate priorities. A
+    /// spill takes O(B) for a budget of B values, plus O(D) to merge the D
+    /// values on a level once it has 16 runs, O(B log(N / B)) amortized.
+    bool enqueue(T value, int priority) {
+        if (buffer.size() >= limit && !spill()) {
+            return false;
+        }
+        buffer.enqueue(value, priority);
+        return true;
+    }
+
+    /// Sets `value` and `priority` to the value with the smallest priority
+    /// and its priority, without removing it. Returns false if the
+    /// `external_prqueue` is empty.
+    ///
+    /// Runs in O(H), where H is the height of the in-memory tree.
+    bool peek(T& value, int& priority) const {
+        if (diskFirst()) {
+            value = runs.front()->value;
+            priority = runs.front()->priority;
+            return true;
+        }
+        return buffer.peek(value, priority);
+    }
+
+    /// Returns the value with the smallest priority and removes it.
+    ///
+    /// If the `external_prqueue` is empty, returns the default value for
+    /// `T`.
+    ///
+    /// Runs in O(H + M) when the value is in memory. Otherwise the buffer is
+    /// refilled first, in O(B log R) for a budget of B values and R runs, or
+    /// if the buffer is full, the value is read straight from disk in
+    /// O(log R).
+    T dequeue() {
+        if (diskFirst()) {
+            if (buffer.size() >= limit) {
+                T value;
+                int priority;
+                popDisk(value, priority);
+                return value;
+            }
+            refill();
+        }
+        return buffer.dequeue();
+    }
+
+    /// Returns the number of values, in memory and on disk.
+    ///
+    /// Runs in O(1).
+    size_t size() const {
+        return buffer.size() + diskSize;
+    }
+
+    /// Returns the number of values held in memory.
+    ///
+    /// Runs in O(1).
+    size_t in_memory() const {
+        return buffer.size();
+    }
+
+    /// Returns the number of run files.
+    ///
+    /// Runs in O(1).
+    size_t run_count() const {
+        return runs.size();
+    }
+
+    /// Returns the number of values dropped because a run file could not be
+    /// read back. They are no longer counted by `size`.
+    ///
+    /// Runs in O(1).
+    size_t lost() const {
+        return lostCount;
+    }
+
+    /// Returns the most values held in memory.
+    ///
+    /// Runs in O(1).
+    size_t budget() const {
+        return limit;
+    }
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <utility>  // For move
+#include <vector>
+
+#include "prqueue.h"
+
+/// Consumes several `prqueue`s in one global priority order without merging
+/// or copying them.
+///
+/// The view keeps a tournament tree over the smallest priority of each
+/// source. `next` dequeues from the source holding the global minimum, then
+/// replays only the matches on that source's path to the root, so choosing
+/// the next value takes O(log K) comparisons for K sources instead of a
+/// `peek` on every one. Equal priorities are taken from the source listed
+/// first.
+///
+/// The view does not own the sources. If a source is changed other than
+/// through the view, call `refresh` with its index before the next `peek` or
+/// `next`.
+template <typename T>
+class merged_view {
+   private:
+    vector<prqueue<T>*> srcs;
+
+    // Cached smallest priority of each source, meaningless while the
+    // source is empty.
+    vector<int> prios;
+    vector<bool> live;
+
+    // winners[n] for 0 < n < K is the source that won the match at internal
+    // node n, and winners[K + i] is leaf i. Node n's parent is n / 2, so
+    // winners[1] is the overall winner.
+    vector<size_t> winners;
+
+    // Returns true if source `a` should be taken before source `b`. Empty
+    // sources lose to everything.
+    bool before(size_t a, size_t b) const {
+        if (!live[a] || !live[b]) {
+            return live[a];
+        }
+        if (prios[a] != prios[b]) {
+            return prios[a] < prios[b];
+        }
+        return a < b;
+    }
+
+    // Re-reads the smallest priority of a source. An empty source keeps its
+    // old, unused priority.
+    void load(size_t source) {
+        T value;
+        int priority = 0;
+        live[source] = srcs[source]->peek(value, priority);
+        if (live[source]) {
+            prios[source] = priority;
+        }
+    }
+
+    // Replays the match at internal node `node`.
+    void play(size_t node) {
+        size_t a = winners[2 * node];
+        size_t b = winners[2 * node + 1];
+        winners[node] = before(a, b) ? a : b;
+    }
+
+    // Returns the source holding the global minimum.
+    size_t winner() const {
+        return (srcs.size() > 1) ? winners[1] : 0;
+    }
+
+   public:
+    /// Creates a view over `sources`, which must outlive it.
+    ///
+    /// Runs in O(K * H), where K is the number of sources, and H is the
+    /// largest height of their trees.
+    explicit merged_view(vector<prqueue<T>*> sources) : srcs(std::move(sources)) {
+        size_t k = srcs.size();
+        prios.assign(k, 0);
+        live.assign(k, false);
+        winners.assign(2 * k, 0);
+        for (size_t i = 0; i < k; i++) {
+            load(i);
+            winners[k + i] = i;
+        }
+        for (size_t node = k - 1; node > 0 && node < k; node--) {
+            play(node);
+        }
+    }
+
+    /// Re-reads the smallest value of `sources[source]` after it was changed
+    /// other than through the view.
+    ///
+    /// Runs in O(H + log K), where H is the height of the source's tree,
+    /// and K is the number of sources.
+    void refresh(size_t source) {
+        load(source);
+        for (size_t node = (srcs.size() + source) / 2; node > 0; node /= 2) {
+            play(node);
+        }
+    }
+
+    /// Returns true if every source is empty.
+    ///
+    /// Runs in O(1).
+    bool empty() const {
+        return srcs.empty() || !live[winner()];
+    }
+
+    /// Returns the number of sources.
+    ///
+    /// Runs in O(1).
+    size_t sources() const {
+        return srcs.size();
+    }
+
+    /// Sets `value` and `priority` to the smallest value across all sources
+    /// and its priority, without removing it. Returns false if every source
+    /// is empty.
+    ///
+    /// Runs in O(H), where H is the height of the winning source's tree.
+    bool peek(T& value, int& priority) const {
+        if (empty()) {
+            return false;
+        }
+        return srcs[winner()]->peek(value, priority);
+    }
+
+    /// Removes the smallest value across all sources and returns it in
+    /// `value`, along with its priority. Returns false if every source is
+    /// empty.
+    ///
+    /// Runs in O(H + log K), where H is the height of the winning source's
+    /// tree, and K is the number of sources.
+    bool next(T& value, int& priority) {
+        if (empty()) {
+            return false;
+        }
+        size_t source = winner();
+        priority = prios[source];
+        value = srcs[source]->dequeue();
+        refresh(source);
+        return true;
+    }
+};
@@ -0,0 +1,427 @@
+#pragma once
+
+#include <algorithm>  // For max and reverse
+#include <cstdint>
+#include <memory>     // For shared_ptr
+#include <sstream>    // For as_string
+#include <utility>    // For pair
+#include <vector>
+
+using namespace std;
+
+/// A persistent (copy-on-write) version of `prqueue`.
+///
+/// Nodes are immutable and reference counted, and are shared between every
+/// copy of a `persistent_prqueue`. Copying is O(1), and `enqueue` and
+/// `dequeue` clone only the O(H) nodes on the path they touch, leaving the
+/// nodes other copies can see untouched. A copy is therefore a consistent
+/// snapshot, which can be read or iterated while the original keeps
+/// changing.
+///
+/// The tree is a treap: besides being ordered by priority, each node's
+/// weight, a fixed hash of its priority, is at least its children's. The
+/// shape only depends on which priorities are held, and the height H is
+/// expected O(log N) for N values, even when priorities arrive sorted.
+///
+/// Long duplicate chains and subtrees are freed one node at a time, so
+/// releasing a version cannot overflow the stack.
+///
+/// Taking the copy itself reads the source's root, so it must be
+/// synchronized with writers to that source; after that, the snapshot and
+/// the source can be used from different threads.
+template <typename T>
+class persistent_prqueue {
+   private:
+    // Links and nodes are created non-const and only shared as const, so
+    // the last owner may take their children apart while freeing them.
+    struct LINK {
+        T value;
+        shared_ptr<const LINK> next;
+
+        // Frees the rest of the chain that only this link holds, one link
+        // at a time
+        ~LINK() {
+            shared_ptr<const LINK> rest = std::move(next);
+            while (rest != nullptr && rest.use_count() == 1) {
+                rest = std::move(const_cast<LINK&>(*rest).next);
+            }
+        }
+    };
+
+    struct NODE {
+        int priority;
+        T value;
+        shared_ptr<const LINK> link;  // Older duplicates, in the order added
+        shared_ptr<const LINK> back;  // Newer duplicates, newest first
+        shared_ptr<const NODE> left;
+        shared_ptr<const NODE> right;
+
+        // Frees the subtrees that only this node holds, one node at a time
+        ~NODE() {
+            vector<shared_ptr<const NODE>> pending;
+            auto take = [&pending](shared_ptr<const NODE>& child) {
+                if (child != nullptr && child.use_count() == 1) {
+                    pending.push_back(std::move(child));
+                }
+            };
+            take(left);
+            take(right);
+            while (!pending.empty()) {
+                shared_ptr<const NODE> node = std::move(pending.back());
+                pending.pop_back();
+                take(const_cast<NODE&>(*node).left);
+                take(const_cast<NODE&>(*node).right);
+            }
+        }
+    };
+
+    shared_ptr<const NODE> root;
+    size_t sz;
+
+    // Utility state for begin and next. `iterRoot` keeps the traversed
+    // version alive if `this` changes during the traversal.
+    shared_ptr<const NODE> iterRoot;
+    vector<const NODE*> stack;
+    vector<const LINK*> chain;
+    size_t chainPos;
+    int chainPriority;
+
+    static shared_ptr<const NODE> makeNode(int priority, const T& value, shared_ptr<const LINK> link,
+                                           shared_ptr<const LINK> back, shared_ptr<const NODE> left,
+                                           shared_ptr<const NODE> right) {
+        return make_shared<NODE>(priority, value, std::move(link), std::move(back), std::move(left),
+                                 std::move(right));
+    }
+
+    // Returns the treap weight of a priority. The mix is a bijection, so
+    // distinct priorities never tie.
+    static uint64_t weight(int priority) {
+        uint64_t x = static_cast<uint32_t>(priority) + 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    // Returns a copy of `node` with different children.
+    static shared_ptr<const NODE> withChildren(const NODE* node, shared_ptr<const NODE> left,
+                                               shared_ptr<const NODE> right) {
+        return makeNode(node->priority, node->value, node->link, node->back, std::move(left), std::move(right));
+    }
+
+    // Appends the duplicates of `node` to `out`, in the order they were
+    // added.
+    static void collect(const NODE* node, vector<const LINK*>& out) {
+        for (const LINK* link = node->link.get(); link != nullptr; link = link->next.get()) {
+            out.push_back(link);
+        }
+        size_t start = out.size();
+        for (const LINK* link = node->back.get(); link != nullptr; link = link->next.get()) {
+            out.push_back(link);
+        }
+        reverse(out.begin() + start, out.end());
+    }
+
+    // Clones the nodes of `path` from the bottom up, replacing the child that
+    // leads towards `priority` with `rebuilt` at each step.
+    static shared_ptr<const NODE> rebuildPath(const vector<const NODE*>& path, int priority,
+                                              shared_ptr<const NODE> rebuilt) {
+        for (size_t i = path.size(); i-- > 0;) {
+            const NODE* node = path[i];
+            if (priority < node->priority) {
+                rebuilt = withChildren(node, rebuilt, node->right);
+            }
+            else {
+                rebuilt = withChildren(node, node->left, rebuilt);
+            }
+        }
+        return rebuilt;
+    }
+
+    void pushLeft(const NODE* node) {
+        while (node != nullptr) {
+            stack.push_back(node);
+            node = node->left.get();
+        }
+    }
+
+    // Recursive helper function to check if two trees are equivalent.
+    bool isEqual(const NODE* node1, const NODE* node2) const {
+        if (node1 == node2) return true;  // Shared, or both empty
+        if (!node1 || !node2) return false;
+
+        if (node1->priority != node2->priority || node1->value != node2->value) return false;
+
+        if (node1->link != node2->link || node1->back != node2->back) {
+            vector<const LINK*> chain1;
+            vector<const LINK*> chain2;
+            collect(node1, chain1);
+            collect(node2, chain2);
+            if (chain1.size() != chain2.size()) return false;
+            for (size_t i = 0; i < chain1.size(); i++) {
+                if (chain1[i]->value != chain2[i]->value) return false;
+            }
+        }
+
+        return isEqual(node1->left.get(), node2->left.get()) && isEqual(node1->right.get(), node2->right.get());
+    }
+
+   public:
+    /// Creates an empty `persistent_prqueue`.
+    /// Runs in O(1).
+    persistent_prqueue() {
+        sz = 0;
+        chainPos = 0;
+        chainPriority = 0;
+    }
+
+    /// Copy constructor. Shares every node with `other`.
+    ///
+    /// Runs in O(1).
+    persistent_prqueue(const persistent_prqueue& other) {
+        root = other.root;
+        sz = other.sz;
+        chainPos = 0;
+        chainPriority = 0;
+    }
+
+    /// Assignment operator; `operator=`. Shares every node with `other`, and
+    /// releases the nodes of `this` that no other copy uses.
+    ///
+    /// Runs in O(1), plus O(N) to free the nodes no longer used.
+    persistent_prqueue& operator=(const persistent_prqueue& other) {
+        root = other.root;
+        sz = other.sz;
+        return *this;
+    }
+
+    /// Empties the `persistent_prqueue`. Nodes still used by other copies
+    /// are kept.
+    ///
+    /// Runs in O(1), plus O(N) to free the nodes no longer used.
+    void clear() {
+        root = nullptr;
+        sz = 0;
+    }
+
+    /// Adds `value` to the `persistent_prqueue` with the given `priority`.
+    ///
+    /// Runs in O(H), where H is the height of the tree, which is expected
+    /// O(log N).
+    void enqueue(T value, int priority) {
+        vector<const NODE*> path;
+        const NODE* current = root.get();
+        while (current != nullptr && current->priority != priority) {
+            path.push_back(current);
+            current = (priority < current->priority) ? current->left.get() : current->right.get();
+        }
+
+        shared_ptr<const NODE> rebuilt;
+        if (current == nullptr) {
+            // A new node goes above the first node on its search path with
+            // a smaller weight. The rest of the path is split into the parts
+            // below and above `priority`, which become its subtrees.
+            uint64_t w = weight(priority);
+            size_t depth = 0;
+            while (depth < path.size() && weight(path[depth]->priority) > w) {
+                depth++;
+            }
+            shared_ptr<const NODE> lower;
+            shared_ptr<const NODE> upper;
+            for (size_t i = path.size(); i-- > depth;) {
+                const NODE* node = path[i];
+                if (node->priority < priority) {
+                    lower = withChildren(node, node->left, lower);
+                }
+                else {
+                    upper = withChildren(node, upper, node->right);
+                }
+            }
+            rebuilt = makeNode(priority, value, nullptr, nullptr, std::move(lower), std::move(upper));
+            path.resize(depth);
+        }
+        else {
+            // Newer duplicates are pushed onto the front of `back`, so no
+            // existing link is copied
+            auto back = make_shared<LINK>(value, current->back);
+            rebuilt = makeNode(current->priority, current->value, current->link, std::move(back), current->left,
+                               current->right);
+        }
+
+        root = rebuildPath(path, priority, rebuilt);
+        sz++;
+    }
+
+    /// Returns the value with the smallest priority in the
+    /// `persistent_prqueue`, but does not modify it.
+    ///
+    /// If the `persistent_prqueue` is empty, returns the default value for
+    /// `T`.
+    ///
+    /// Runs in O(H), where H is the height of the tree, which is expected
+    /// O(log N).
+    T peek() const {
+        const NODE* current = root.get();
+        if (current == nullptr) {
+            return T{};
+        }
+        while (current->left != nullptr) {
+            current = current->left.get();
+        }
+        return current->value;
+    }
+
+    /// Returns the value with the smallest priority in the
+    /// `persistent_prqueue` and removes it.
+    ///
+    /// If the `persistent_prqueue` is empty, returns the default value for
+    /// `T`.
+    ///
+    /// Runs in amortized O(H), where H is the height of the tree, which is
+    /// expected O(log N). When the older duplicates of the smallest priority
+    /// run out, the newer ones are reversed into their place in O(M), where
+    /// M is the number of duplicates; dequeuing repeatedly from copies of
+    /// that same version pays this each time.
+    T dequeue() {
+        if (root == nullptr) {
+            return T();
+        }
+
+        vector<const NODE*> path;
+        const NODE* current = root.get();
+        while (current->left != nullptr) {
+            path.push_back(current);
+            current = current->left.get();
+        }
+
+        T result = current->value;
+
+        // The next duplicate takes the leftmost node's place, otherwise its
+        // right subtree does, whose weights are no larger
+        shared_ptr<const NODE> rebuilt = current->right;
+        shared_ptr<const LINK> link = current->link;
+        shared_ptr<const LINK> back = current->back;
+        if (link == nullptr) {
+            for (const LINK* newer = back.get(); newer != nullptr; newer = newer->next.get()) {
+                link = make_shared<LINK>(newer->value, link);
+            }
+            back = nullptr;
+        }
+        if (link != nullptr) {
+            rebuilt = makeNode(current->priority, link->value, link->next, back, nullptr, current->right);
+        }
+
+        root = rebuildPath(path, current->priority, rebuilt);
+        sz--;
+        return result;
+    }
+
+    /// Returns the height of the tree: the number of nodes on its longest
+    /// path from the root, not counting duplicates.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    size_t height() const {
+        size_t best = 0;
+        vector<pair<const NODE*, size_t>> pending;
+        if (root != nullptr) {
+            pending.push_back({root.get(), 1});
+        }
+        while (!pending.empty()) {
+            auto [node, depth] = pending.back();
+            pending.pop_back();
+            best = max(best, depth);
+            if (node->left != nullptr) {
+                pending.push_back({node->left.get(), depth + 1});
+            }
+            if (node->right != nullptr) {
+                pending.push_back({node->right.get(), depth + 1});
+            }
+        }
+        return best;
+    }
+
+    /// Returns the number of elements in the `persistent_prqueue`.
+    ///
+    /// Runs in O(1).
+    size_t size() const {
+        return sz;
+    }
+
+    /// Resets internal state for an iterative inorder traversal of the
+    /// current version. Later changes to `this` do not affect the traversal.
+    ///
+    /// See `next` for usage details.
+    ///
+    /// O(H), where H is the maximum height of the tree.
+    void begin() {
+        iterRoot = root;
+        stack.clear();
+        chain.clear();
+        chainPos = 0;
+        pushLeft(iterRoot.get());
+    }
+
+    /// Uses the internal state to return the next in-order value and priority
+    /// by reference, and advances the internal state. Returns true if the
+    /// reference parameters were set, and false otherwise.
+    ///
+    /// Runs in amortized O(1), and worst-case O(H).
+    bool next(T& value, int& priority) {
+        if (chainPos < chain.size()) {
+            value = chain[chainPos++]->value;
+            priority = chainPriority;
+            return true;
+        }
+        if (stack.empty()) {
+            iterRoot = nullptr;
+            return false;
+        }
+
+        const NODE* node = stack.back();
+        stack.pop_back();
+        value = node->value;
+        priority = node->priority;
+        chain.clear();
+        chainPos = 0;
+        collect(node, chain);
+        chainPriority = node->priority;
+        pushLeft(node->right.get());
+        return true;
+    }
+
+    /// Converts the `persistent_prqueue` to a string representation, with the
+    /// values in-order by priority, in the same format as `prqueue`.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    string as_string() const {
+        ostringstream output;
+        vector<const NODE*> pending;
+        vector<const LINK*> dups;
+        const NODE* node = root.get();
+        while (node != nullptr || !pending.empty()) {
+            while (node != nullptr) {
+                pending.push_back(node);
+                node = node->left.get();
+            }
+            node = pending.back();
+            pending.pop_back();
+
+            output << node->priority << " value: " << node->value << endl;
+            dups.clear();
+            collect(node, dups);
+            for (const LINK* link : dups) {
+                output << node->priority << " value: " << link->value << endl;
+            }
+            node = node->right.get();
+        }
+        return output.str();
+    }
+
+    /// Checks if the contents of `this` and `other` are equivalent, with the
+    /// same meaning as `prqueue::operator==`. Subtrees shared by both are
+    /// skipped.
+    ///
+    /// Runs in O(N) time, where N is the number of nodes not shared by both.
+    bool operator==(const persistent_prqueue& other) const {
+        return sz == other.sz && isEqual(root.get(), other.root.get());
+    }
+};
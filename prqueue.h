@@ -1,307 +1,1880 @@
 #pragma once
 
-#include <iostream>  // For debugging
-#include <sstream>   // For as_string
+#include <algorithm>    // For stable_sort and inplace_merge
+#include <climits>      // For LLONG_MAX
+#include <functional>   // For hash
+#include <future>       // For async
+#include <iostream>     // For debugging
+#include <mutex>        // For the fingerprint cache
+#include <span>         // For frozen
+#include <sstream>      // For as_string
+#include <thread>       // For hardware_concurrency
+#include <tuple>        // For copyTree
+#include <type_traits>  // For is_default_constructible_v
+#include <unordered_map>
+#include <utility>      // For pair
+#include <vector>
+
+#include "prqueue_trace.h"
 
 using namespace std;
 
-template <typename T>
+/// `Key` is the type of the optional value index, see `index_by`.
+template <typename T, typename Key = void>
 class prqueue {
    private:
+    struct HEAD;
+
     struct NODE {
         int priority;
         T value;
-        NODE* parent;
-        NODE* left;
-        NODE* right;
+        HEAD* parent;  // For duplicates, the tree node of their priority
+
+        // Duplicates have no children, so they keep the previous value in
+        // their chain instead. The first duplicate keeps the chain's tail,
+        // so both ends of a chain are reached in O(1).
+        union {
+            HEAD* left;
+            NODE* prev;
+        };
+        HEAD* right;
         NODE* link;  // Link to duplicates -- Part 2 only
     };
 
-    NODE* root;
+    // A tree node, which heads the duplicate chain of its priority and
+    // keeps the fields of the whole class, so duplicates stay as small as
+    // a `NODE`. A `HEAD` that joins another chain is used as a plain `NODE`.
+    // A bounded `prqueue` allocates its duplicates as `HEAD`s too, so an
+    // evicted node can be reused for either kind (see `set_capacity`).
+    struct HEAD : NODE {
+        size_t count;  // Values in the priority class
+
+        // Structural hashes, refreshed lazily by `fingerprint`. 0 marks a
+        // stale one. A node with a stale class hash has a stale subtree hash,
+        // and every ancestor of a node with a stale subtree hash has one too.
+        mutable size_t classHash;    // Priority and the values in the duplicate chain
+        mutable size_t subtreeHash;  // classHash combined with both subtrees
+    };
+
+    HEAD* root;
     size_t sz;
 
+    // Cached rightmost (largest priority) tree node and the last value in
+    // its duplicate chain, used for bounded mode and the append fast path.
+    HEAD* maxNode;
+    NODE* maxTail;
+    // Maximum number of values to hold; 0 means unbounded.
+    size_t cap;
+
+    // Enqueue counters, see `stats`. `spineAppends` counts the tree nodes
+    // appended by the fast path since the tree was last rebalanced.
+    size_t fastPathHits;
+    size_t descents;
+    size_t rebalances;
+    size_t spineAppends;
+
+    // Optional index of the nodes holding each key, see `index_by`. Empty
+    // while `keyOf` is unset.
+    using IndexKey = conditional_t<is_void_v<Key>, int, Key>;
+    function<IndexKey(const T&)> keyOf;
+    unordered_multimap<IndexKey, NODE*> index;
+
+    // Optional operation recorder, see `set_recorder`.
+    trace_recorder* recorder;
+
+    // Guards the subtree hashes that `fingerprint` refreshes, since it is
+    // const and may run alongside other readers.
+    mutable mutex hashLock;
+
     // Utility pointers for begin and next.
     NODE* curr;
     NODE* temp;  // Optional
 
     // TODO_STUDENT: add private helper function definitions here
-    void _recursiveHelper(const NODE* node, ostream& output) const {
+    void _recursiveHelper(const HEAD* node, ostream& output) const {
+        _inorder(node, [&output](const HEAD* head) {
+            // Append the priority and value to the output stream
+            output << head->priority << " value: " << head->value << endl;
+
+            // Check and append duplicate values
+            NODE* current = head->link;
+            while (current != nullptr) {
+                output << head->priority << " value: " << current->value << endl;
+                current = current->link;
+            }
+        });
+    }
+
+    // Calls `fn(head)` for every tree node of the subtree rooted at `node`,
+    // in order. Keeps its own stack of the pending left ancestors, so a
+    // tree as deep as the number of values cannot overflow the call stack.
+    template <typename Fn>
+    static void _inorder(const HEAD* node, Fn fn) {
+        vector<const HEAD*> stack;
+        while (node != nullptr || !stack.empty()) {
+            while (node != nullptr) {
+                stack.push_back(node);
+                node = node->left;
+            }
+            node = stack.back();
+            stack.pop_back();
+            fn(node);
+            node = node->right;
+        }
+    }
+
+    static size_t hashCombine(size_t seed, size_t value) {
+        return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+    }
+
+    // Values without a `hash` specialization still compare by structure and
+    // priority; only `operator==` looks at them.
+    static size_t hashValue(const T& value) {
+        if constexpr (is_default_constructible_v<hash<T>>) {
+            return hash<T>{}(value);
+        }
+        else {
+            return 0;
+        }
+    }
+
+    // Adds one value to a class hash, never giving the stale marker 0.
+    static size_t classStep(size_t seed, const T& value) {
+        size_t h = hashCombine(seed, hashValue(value));
+        return (h != 0) ? h : 1;
+    }
+
+    // Recomputes the hash of a tree node's priority and duplicate chain.
+    void rehashClass(HEAD* node) const {
+        size_t h = classStep(hash<int>{}(node->priority), node->value);
+        for (NODE* dup = node->link; dup != nullptr; dup = dup->link) {
+            h = classStep(h, dup->value);
+        }
+        node->classHash = h;
+    }
+
+    // Adds a value appended to a tree node's chain to its class hash, and
+    // marks the path above it as stale.
+    void hashAppended(HEAD* node, const T& value) {
+        if (node->classHash != 0) {
+            node->classHash = classStep(node->classHash, value);
+        }
+        invalidatePath(node);
+    }
+
+    // Marks a tree node whose chain lost a value, and the path above it, as
+    // stale. The chain is rehashed by the next `fingerprint`.
+    void invalidateClass(HEAD* node) {
+        node->classHash = 0;
+        node->subtreeHash = 0;
+        invalidatePath(node->parent);
+    }
+
+    // Recomputes a tree node's subtree hash from its children, which must
+    // not be stale, and its class hash if that is stale.
+    void rehashNode(HEAD* node) const {
+        if (node->classHash == 0) {
+            rehashClass(node);
+        }
+        size_t h = hashCombine(node->classHash, node->left != nullptr ? node->left->subtreeHash : 1);
+        h = hashCombine(h, node->right != nullptr ? node->right->subtreeHash : 2);
+        node->subtreeHash = (h != 0) ? h : 1;
+    }
+
+    // Marks the subtree hashes from a tree node up to the root as stale,
+    // stopping at the first node that already is. Amortized O(1), since
+    // every node marked is refreshed at most once.
+    void invalidatePath(HEAD* node) {
+        while (node != nullptr && node->subtreeHash != 0) {
+            node->subtreeHash = 0;
+            node = node->parent;
+        }
+    }
+
+    // Marks a node just linked into the tree, and the path above it, as
+    // stale. Its own hash is left over from earlier use, so it is not
+    // trusted to stop the walk.
+    void invalidateNew(HEAD* node) {
+        node->subtreeHash = 0;
+        invalidatePath(node->parent);
+    }
+
+    // Recomputes every stale subtree hash, children first.
+    void refreshHashes() const {
+        if (root == nullptr || root->subtreeHash != 0) {
+            return;
+        }
+        vector<HEAD*> stack{root};
+        while (!stack.empty()) {
+            HEAD* node = stack.back();
+            if (node->left != nullptr && node->left->subtreeHash == 0) {
+                stack.push_back(node->left);
+            }
+            else if (node->right != nullptr && node->right->subtreeHash == 0) {
+                stack.push_back(node->right);
+            }
+            else {
+                rehashNode(node);
+                stack.pop_back();
+            }
+        }
+    }
+
+    // Adds a node's value to the index.
+    void indexAdd(NODE* node) {
+        if (keyOf) {
+            index.insert({keyOf(node->value), node});
+        }
+    }
+
+    // Removes a node's value from the index.
+    void indexRemove(NODE* node) {
+        if (!keyOf) {
+            return;
+        }
+        auto range = index.equal_range(keyOf(node->value));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == node) {
+                index.erase(it);
+                return;
+            }
+        }
+    }
+
+    // Points the index at `to` for the value just moved there from `from`.
+    void indexMove(NODE* from, NODE* to) {
+        if (!keyOf) {
+            return;
+        }
+        auto range = index.equal_range(keyOf(to->value));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == from) {
+                it->second = to;
+                return;
+            }
+        }
+    }
+
+    // Rebuilds the index from scratch.
+    void reindex() {
+        index.clear();
+        if (keyOf) {
+            _sweep([this](NODE* node, int) { indexAdd(node); });
+        }
+    }
+
+    // Returns the last value in a tree node's duplicate chain, which is the
+    // node itself if it has no duplicates.
+    static NODE* chainTail(HEAD* head) {
+        return (head->link != nullptr) ? head->link->prev : head;
+    }
+
+    // Appends the linked nodes `first` to `last` to the chain of the tree
+    // node `head`. Each node after `first` must already point back to the
+    // one before it. Parents, counts and hashes are left to the caller.
+    static void appendChain(HEAD* head, NODE* first, NODE* last) {
+        NODE* tail = chainTail(head);
+        tail->link = first;
+        last->link = nullptr;
+        if (tail == head) {
+            first->prev = last;
+        }
+        else {
+            first->prev = tail;
+            head->link->prev = last;
+        }
+    }
+
+    // Removes a tree node's value by moving its first duplicate's value into
+    // it, so the node stays in place. The caller updates the hashes.
+    void shiftChain(HEAD* head) {
+        indexRemove(head);
+        temp = head->link;
+        head->value = temp->value;
+        head->link = temp->link;
+        if (head->link != nullptr) {
+            head->link->prev = temp->prev;
+        }
+        indexMove(temp, head);
+        if (temp == maxTail) {
+            maxTail = head;
+        }
+        freeNode(temp);
+        head->count--;
+        sz--;
+    }
+
+    // Caches `node` as the largest tree node, along with its chain's tail.
+    void setMax(HEAD* node) {
+        maxNode = node;
+        maxTail = (node != nullptr) ? chainTail(node) : nullptr;
+    }
+
+    // Allocates an uninitialized duplicate. A bounded `prqueue` gives
+    // duplicates the size of a tree node, so an evicted node of either kind
+    // can hold any new value.
+    NODE* allocDuplicate() const {
+        return (cap != 0) ? new HEAD : new NODE;
+    }
+
+    // Creates an unlinked duplicate.
+    NODE* createNode(const T& value, int priority) const {
+        NODE* newNode = allocDuplicate();
+        initNode(newNode, value, priority);
+        return newNode;
+    }
+
+    // Reallocates every duplicate with the size of a tree node, keeping the
+    // chains in order, for a `prqueue` that becomes bounded.
+    void widenDuplicates() {
+        if (root == nullptr) {
+            return;
+        }
+        for (HEAD* node = leftmost(root); node != nullptr; node = successor(node)) {
+            NODE* dup = node->link;
+            node->link = nullptr;
+            while (dup != nullptr) {
+                NODE* next = dup->link;
+                HEAD* wide = new HEAD;
+                initNode(wide, dup->value, dup->priority);
+                indexMove(dup, wide);
+                wide->parent = node;
+                appendChain(node, wide, wide);
+                freeNode(dup);
+                dup = next;
+            }
+        }
+        setMax(maxNode);
+        curr = nullptr;
+    }
+
+    // Creates an unlinked tree node holding one value.
+    static HEAD* createHead(const T& value, int priority) {
+        HEAD* newNode = new HEAD;
+        initNode(newNode, value, priority);
+        newNode->count = 1;
+        return newNode;
+    }
+
+    static void initNode(NODE* node, const T& value, int priority) {
+        node->value = value;
+        node->priority = priority;
+        node->parent = nullptr;
+        node->left = nullptr;
+        node->right = nullptr;
+        node->link = nullptr;
+    }
+
+    // Frees a node of either kind. A `HEAD` may have joined another chain,
+    // so nodes are freed by address rather than with `delete`, which would
+    // need the type they were created as.
+    static void freeNode(NODE* node) {
+        node->~NODE();
+        ::operator delete(node);
+    }
+
+    // Returns the leftmost node of the subtree rooted at `node`.
+    HEAD* leftmost(HEAD* node) const {
+        while (node->left != nullptr) {
+            node = node->left;
+        }
+        return node;
+    }
+
+    // Returns the in-order successor of a tree node, or nullptr.
+    HEAD* successor(HEAD* node) const {
+        if (node->right != nullptr) {
+            return leftmost(node->right);
+        }
+        while (node->parent != nullptr && node->parent->right == node) {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+
+    // Calls `fn(node, priority)` for every value's node in order, walking
+    // the tree iteratively through parent links.
+    template <typename Fn>
+    void _sweep(Fn fn) const {
+        if (root == nullptr) {
+            return;
+        }
+        for (HEAD* node = leftmost(root); node != nullptr; node = successor(node)) {
+            for (NODE* dup = node; dup != nullptr; dup = dup->link) {
+                fn(dup, node->priority);
+            }
+        }
+    }
+
+    // Helper function to find the height of a subtree, walking it with its
+    // own stack.
+    size_t _height(const HEAD* node) const {
+        size_t height = 0;
+        vector<pair<const HEAD*, size_t>> stack;
         if (node != nullptr) {
-            _recursiveHelper(node->left, output);
+            stack.push_back({node, 1});
+        }
+        while (!stack.empty()) {
+            auto [current, depth] = stack.back();
+            stack.pop_back();
+            height = max(height, depth);
+            if (current->left != nullptr) {
+                stack.push_back({current->left, depth + 1});
+            }
+            if (current->right != nullptr) {
+                stack.push_back({current->right, depth + 1});
+            }
+        }
+        return height;
+    }
 
-            // Append the priority and value to the output stream
-            output << node->priority << " value: " << node->value << endl;
+    // Helper function to count the values in a subtree.
+    size_t _count(const HEAD* node) const {
+        size_t count = 0;
+        _inorder(node, [&count](const HEAD* head) { count += head->count; });
+        return count;
+    }
+
+    // Returns the rightmost node of the subtree rooted at `node`.
+    HEAD* rightmost(HEAD* node) const {
+        while (node->right != nullptr) {
+            node = node->right;
+        }
+        return node;
+    }
+
+    // Returns the tree node holding `priority`, or nullptr.
+    HEAD* findClass(int priority) const {
+        HEAD* current = root;
+        while (current != nullptr && current->priority != priority) {
+            current = (priority < current->priority) ? current->left : current->right;
+        }
+        return current;
+    }
+
+    // Unlinks a tree node with at most one child, and its duplicate chain,
+    // without freeing them.
+    void detachNode(HEAD* node) {
+        HEAD* parent = node->parent;
+        HEAD* child = (node->left != nullptr) ? node->left : node->right;
+
+        // If the node is not the root, adjust its parent's pointer
+        if (parent != nullptr) {
+            if (parent->left == node) {
+                parent->left = child;
+            }
+            else {
+                parent->right = child;
+            }
+        }
+        else {
+            // If the node is the root, update the root pointer
+            root = child;
+        }
+        if (child != nullptr) {
+            child->parent = parent;
+        }
+
+        // The largest node never has a right child, so its successor as the
+        // maximum is the rightmost node of its left subtree, or its parent.
+        if (node == maxNode) {
+            setMax((child != nullptr) ? rightmost(child) : parent);
+        }
+        sz -= node->count;
+    }
+
+    // Unlinks any tree node and its duplicate chain, without freeing them.
+    // A node with two children is replaced by its in-order successor, which
+    // is relinked rather than copied, so no other node or chain moves.
+    void unlinkClass(HEAD* node) {
+        if (node->left == nullptr || node->right == nullptr) {
+            detachNode(node);
+            invalidatePath(node->parent);
+            return;
+        }
+
+        HEAD* succ = leftmost(node->right);
+        HEAD* changed = succ;
+        if (succ->parent != node) {
+            changed = succ->parent;
+            succ->parent->left = succ->right;
+            if (succ->right != nullptr) {
+                succ->right->parent = succ->parent;
+            }
+            succ->right = node->right;
+            succ->right->parent = succ;
+        }
+        succ->left = node->left;
+        succ->left->parent = succ;
+
+        succ->parent = node->parent;
+        if (node->parent == nullptr) {
+            root = succ;
+        }
+        else if (node->parent->left == node) {
+            node->parent->left = succ;
+        }
+        else {
+            node->parent->right = succ;
+        }
+
+        // The successor moved above nodes whose hashes may be fresh, so it
+        // and its new ancestors are marked separately
+        invalidatePath(changed);
+        succ->subtreeHash = 0;
+        invalidatePath(succ->parent);
+        sz -= node->count;
+    }
+
+    void removeNode(HEAD* node) {
+        if (node == nullptr) {
+            return;
+        }
+        detachNode(node);
+        invalidatePath(node->parent);
+        indexRemove(node);
+        freeNode(node);
+    }
+
+    // Unlinks the worst value, which is the tail of the largest node's
+    // duplicate chain, or the largest node itself, in amortized O(1).
+    // Returns the unlinked node, which is a `HEAD` in the second case.
+    NODE* evictMax() {
+        if (maxNode->link == nullptr) {
+            HEAD* node = maxNode;
+            detachNode(node);
+            invalidatePath(node->parent);
+            indexRemove(node);
+            return node;
+        }
+
+        NODE* node = maxTail;
+        if (node == maxNode->link) {
+            maxNode->link = nullptr;
+            maxTail = maxNode;
+        }
+        else {
+            maxTail = node->prev;
+            maxTail->link = nullptr;
+            maxNode->link->prev = maxTail;
+        }
+        maxNode->count--;
+        invalidateClass(maxNode);
+        indexRemove(node);
+        sz--;
+        return node;
+    }
+
+    // Links the class heads `heads[lo, hi)`, sorted by priority and with
+    // their duplicate chains attached, into a balanced subtree under
+    // `parent`. Returns the root of the subtree.
+    HEAD* buildBalanced(const vector<HEAD*>& heads, size_t lo, size_t hi, HEAD* parent) {
+        if (lo >= hi) {
+            return nullptr;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        HEAD* node = heads[mid];
+        node->parent = parent;
+        node->left = buildBalanced(heads, lo, mid, node);
+        node->right = buildBalanced(heads, mid + 1, hi, node);
+        rehashClass(node);
+        rehashNode(node);
+        return node;
+    }
+
+    // Links the first `count` tree nodes of `list`, a list linked by `right`
+    // in priority order, into a balanced subtree under `parent`, and
+    // advances `list` past them. Gives the same shape as `buildBalanced`.
+    HEAD* buildFromList(HEAD*& list, size_t count, HEAD* parent) {
+        if (count == 0) {
+            return nullptr;
+        }
+        HEAD* left = buildFromList(list, count / 2, nullptr);
+        HEAD* node = list;
+        list = node->right;
+        node->parent = parent;
+        node->left = left;
+        if (left != nullptr) {
+            left->parent = node;
+        }
+        node->right = buildFromList(list, count - count / 2 - 1, node);
+        rehashNode(node);
+        return node;
+    }
+
+    static bool byPriority(const pair<T, int>& a, const pair<T, int>& b) {
+        return a.second < b.second;
+    }
+
+    // Stable sorts `items[lo, hi)` by priority, sorting the halves on
+    // separate threads while more than one thread is available.
+    static void parallelSort(vector<pair<T, int>>& items, size_t lo, size_t hi, unsigned threads) {
+        if (threads <= 1 || hi - lo < 4096) {
+            stable_sort(items.begin() + lo, items.begin() + hi, byPriority);
+            return;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        auto left = async(launch::async, [&] { parallelSort(items, lo, mid, threads / 2); });
+        parallelSort(items, mid, hi, threads - threads / 2);
+        left.get();
+        inplace_merge(items.begin() + lo, items.begin() + mid, items.begin() + hi, byPriority);
+    }
+
+    // Creates the nodes for the priority classes `starts[lo, hi)` of the
+    // sorted `items`, and links them into a balanced subtree under `parent`.
+    // Class i holds `items[starts[i], starts[i + 1])`. The left subtree is
+    // built on another thread while more than one thread is available.
+    HEAD* buildParallel(const vector<pair<T, int>>& items, const vector<size_t>& starts, size_t lo, size_t hi,
+                        HEAD* parent, unsigned threads) {
+        if (lo >= hi) {
+            return nullptr;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        HEAD* node = createHead(items[starts[mid]].first, items[starts[mid]].second);
+        node->parent = parent;
+        node->count = starts[mid + 1] - starts[mid];
+        for (size_t i = starts[mid] + 1; i < starts[mid + 1]; i++) {
+            NODE* dup = createNode(items[i].first, items[i].second);
+            dup->parent = node;
+            appendChain(node, dup, dup);
+        }
+
+        if (threads > 1 && hi - lo > 1024) {
+            auto left = async(launch::async, [&] {
+                return buildParallel(items, starts, lo, mid, node, threads / 2);
+            });
+            node->right = buildParallel(items, starts, mid + 1, hi, node, threads - threads / 2);
+            node->left = left.get();
+        }
+        else {
+            node->left = buildParallel(items, starts, lo, mid, node, 1);
+            node->right = buildParallel(items, starts, mid + 1, hi, node, 1);
+        }
+        rehashClass(node);
+        rehashNode(node);
+        return node;
+    }
+
+    // Recursive helper for the parallel `for_each`.
+    template <typename Fn>
+    void _forEach(const HEAD* node, Fn& fn, unsigned threads) const {
+        if (node == nullptr) {
+            return;
+        }
+        if (threads <= 1) {
+            _inorder(node, [&fn](const HEAD* head) {
+                for (const NODE* dup = head; dup != nullptr; dup = dup->link) {
+                    fn(dup->value, head->priority);
+                }
+            });
+            return;
+        }
+
+        unsigned half = threads / 2;
+        future<void> left = async(launch::async, [this, node, &fn, half] { _forEach(node->left, fn, half); });
+        threads -= half;
+
+        for (const NODE* dup = node; dup != nullptr; dup = dup->link) {
+            fn(dup->value, node->priority);
+        }
+        _forEach(node->right, fn, threads);
+        left.get();
+    }
+
+    // Recursive helper for the parallel `as_string`. Builds the text of the
+    // left subtree on another thread and joins it in order.
+    string _parallelString(const HEAD* node, unsigned threads) const {
+        if (node == nullptr) {
+            return "";
+        }
+        if (threads <= 1) {
+            ostringstream output;
+            _recursiveHelper(node, output);
+            return output.str();
+        }
+
+        auto left = async(launch::async, [&] { return _parallelString(node->left, threads / 2); });
+        ostringstream middle;
+        for (const NODE* dup = node; dup != nullptr; dup = dup->link) {
+            middle << node->priority << " value: " << dup->value << endl;
+        }
+        string right = _parallelString(node->right, threads - threads / 2);
+        return left.get() + middle.str() + right;
+    }
+
+    // Creates nodes for `items[lo, hi)`, which are sorted by priority, and
+    // links them into a balanced subtree under `parent`.
+    HEAD* buildGroup(const vector<pair<T, int>>& items, size_t lo, size_t hi, HEAD* parent) {
+        vector<HEAD*> heads;
+        for (size_t i = lo; i < hi; i++) {
+            NODE* newNode;
+            if (!heads.empty() && heads.back()->priority == items[i].second) {
+                newNode = createNode(items[i].first, items[i].second);
+                newNode->parent = heads.back();
+                appendChain(heads.back(), newNode, newNode);
+                heads.back()->count++;
+            }
+            else {
+                heads.push_back(createHead(items[i].first, items[i].second));
+                newNode = heads.back();
+            }
+            indexAdd(newNode);
+        }
+        return buildBalanced(heads, 0, heads.size(), parent);
+    }
+
+    // Finds where a value with `priority` goes. Returns the tree node of
+    // that priority, or nullptr if there is none, with `parent` set to the
+    // tree node a new one goes under, or nullptr if the tree is empty.
+    HEAD* locate(int priority, HEAD*& parent) {
+        parent = nullptr;
+        if (root == nullptr) {
+            return nullptr;
+        }
+
+        // Fast path: a priority at or beyond the largest one goes at the end
+        // of the largest node's chain, or becomes its right child, which is
+        // where the descent would end up
+        // Appends leave a right spine behind them. Once it is long and makes
+        // up at least half of the tree, rebalance before placing the next
+        // value, whether it is appended or not. The largest node stays the
+        // rightmost one.
+        if (spineAppends >= 64 && spineAppends * 2 >= sz) {
+            rebalanceTree();
+        }
+
+        if (priority >= maxNode->priority) {
+            fastPathHits++;
+            if (priority == maxNode->priority) {
+                return maxNode;
+            }
+            parent = maxNode;
+            return nullptr;
+        }
+        descents++;
+
+        // Otherwise, find where the new node goes
+        HEAD* current = root;
+        while (current != nullptr) {
+            if (priority == current->priority) {
+                return current;
+            }
+            parent = current;
+            current = (priority < current->priority) ? current->left : current->right;
+        }
+        return nullptr;
+    }
+
+    // Appends an initialized, unlinked duplicate to the chain of the tree
+    // node `head`, without counting it.
+    void linkDuplicate(HEAD* head, NODE* newNode) {
+        appendChain(head, newNode, newNode);
+        newNode->parent = head;
+        if (head == maxNode) {
+            maxTail = newNode;
+        }
+        head->count++;
+        hashAppended(head, newNode->value);
+    }
+
+    // Links an initialized, unlinked tree node, with its duplicate chain,
+    // under the `parent` that `locate` found for its priority, without
+    // counting it.
+    void linkHead(HEAD* parent, HEAD* newNode) {
+        newNode->parent = parent;
+        if (parent == nullptr) {
+            root = newNode;
+            setMax(newNode);
+        }
+        else if (newNode->priority < parent->priority) {
+            parent->left = newNode;
+        }
+        else {
+            parent->right = newNode;
+            if (parent == maxNode) {
+                setMax(newNode);
+                spineAppends++;
+            }
+        }
+        newNode->classHash = 0;
+        invalidateNew(newNode);
+    }
+
+    // Places an unlinked tree node and its duplicate chain into the tree,
+    // without counting them. Its priority must not be in the tree yet.
+    void insertNode(HEAD* newNode) {
+        HEAD* parent;
+        locate(newNode->priority, parent);
+        linkHead(parent, newNode);
+    }
+
+    // Frees every node of the subtree rooted at `node`. Iterative, rotating
+    // left children up, so a long right spine cannot overflow the stack.
+    void _clear(HEAD* node) {
+        while (node != nullptr) {
+            if (node->left != nullptr) {
+                HEAD* left = node->left;
+                node->left = left->right;
+                left->right = node;
+                node = left;
+                continue;
+            }
+
+            // Clear linked list of duplicates
+            while (node->link != nullptr) {
+                NODE* delVal = node->link;
+                node->link = node->link->link;
+                freeNode(delVal);
+            }
+
+            HEAD* right = node->right;
+            freeNode(node);
+            node = right;
+        }
+    }
+
+    // Empties the tree like `clear`, without recording it, for the copies,
+    // moves and destruction that replace the contents.
+    void release() {
+        _clear(root);
+        root = nullptr; // Reset the root to nullptr after clearing
+        index.clear();
+        maxNode = nullptr;
+        maxTail = nullptr;
+        spineAppends = 0;
+        sz = 0;
+    }
+
+    // Rebuilds the tree perfectly balanced, like `rebalance`, without
+    // recording it, since replaying the appends repeats the automatic
+    // rebalances.
+    void rebalanceTree() {
+        spineAppends = 0;
+        if (root == nullptr) {
+            return;
+        }
+
+        // Flatten the tree into a list linked by `right`, rotating left
+        // children up, then rebuild it from the list, allocating nothing
+        HEAD* list = root;
+        HEAD** hook = &list;
+        size_t classes = 0;
+        while (*hook != nullptr) {
+            HEAD* node = *hook;
+            if (node->left != nullptr) {
+                HEAD* left = node->left;
+                node->left = left->right;
+                left->right = node;
+                *hook = left;
+            }
+            else {
+                hook = &node->right;
+                classes++;
+            }
+        }
+        root = buildFromList(list, classes, nullptr);
+        rebalances++;
+    }
+    
+    /// Helper function to copy nodes. Returns a copy of the subtree rooted
+    /// at `otherNode`, with its duplicate chains and hashes, linked under
+    /// `parent`. Keeps its own stack of the subtrees left to copy, so a
+    /// deep tree cannot overflow the call stack.
+    HEAD* copyTree(const HEAD* otherNode, HEAD* parent) {
+        HEAD* result = nullptr;
+
+        // Each entry is a subtree to copy, its parent's copy, and the
+        // pointer to set to the copy
+        vector<tuple<const HEAD*, HEAD*, HEAD**>> stack{{otherNode, parent, &result}};
+        while (!stack.empty()) {
+            auto [from, up, slot] = stack.back();
+            stack.pop_back();
+            if (from == nullptr) {
+                *slot = nullptr;
+                continue;
+            }
+            HEAD* node = createHead(from->value, from->priority);
+            node->parent = up;
+            node->count = from->count;
+            node->classHash = from->classHash;
+            node->subtreeHash = from->subtreeHash;
+            *slot = node;
+
+            // If there's a linked list of nodes with the same priority, copy it
+            for (const NODE* dup = from->link; dup != nullptr; dup = dup->link) {
+                NODE* copy = createNode(dup->value, dup->priority);
+                copy->parent = node;
+                appendChain(node, copy, copy);
+            }
+
+            stack.push_back({from->right, node, &node->right});
+            stack.push_back({from->left, node, &node->left});
+        }
+        return result;
+    }
+
+    // Helper function to check if two trees are equivalent, walking both
+    // with one stack of node pairs.
+    bool isEqual(const HEAD* first, const HEAD* second) const {
+        vector<pair<const HEAD*, const HEAD*>> stack{{first, second}};
+        while (!stack.empty()) {
+            auto [node1, node2] = stack.back();
+            stack.pop_back();
+            if (!node1 && !node2) continue; // Both trees are empty
+            if (!node1 || !node2) return false; // One tree is empty, the other is not
+
+            // Check if priorities and values are equal
+            if (node1->priority != node2->priority || node1->value != node2->value) return false;
+
+            // Check if the duplicate chains are equal
+            NODE* link1 = node1->link;
+            NODE* link2 = node2->link;
+            while (link1 && link2) {
+                if (link1->value != link2->value) return false;
+                link1 = link1->link;
+                link2 = link2->link;
+            }
+            if (link1 || link2) return false;
+
+            // Check left and right subtrees
+            stack.push_back({node1->right, node2->right});
+            stack.push_back({node1->left, node2->left});
+        }
+        return true;
+    }
+    
+   public:
+    /// A flattened, read-only copy of a `prqueue`'s contents in priority
+    /// order, stored as two parallel arrays. Returned by `freeze`.
+    class frozen {
+       private:
+        friend class prqueue;
+
+        vector<int> prios;
+        vector<T> vals;
+
+       public:
+        /// The priorities, in order.
+        span<const int> priorities() const {
+            return prios;
+        }
+
+        /// The values, in the same order as `priorities`.
+        span<const T> values() const {
+            return vals;
+        }
+
+        /// The number of values.
+        size_t size() const {
+            return vals.size();
+        }
+    };
+
+    /// A read-only cursor over a `prqueue`'s values in priority order,
+    /// duplicates included, that leaves the `begin`/`next` state alone.
+    /// Returned by `peek_view`. Changing the `prqueue` invalidates it.
+    class view {
+       private:
+        friend class prqueue;
+
+        const prqueue* owner;
+        HEAD* node;  // Tree node holding the current priority
+        NODE* dup;   // Next value in its duplicate chain
+
+        view(const prqueue* pq, HEAD* first) : owner(pq), node(first), dup(first) {}
+
+       public:
+        /// Sets `value` and `priority` to the next value and its priority,
+        /// and advances. Returns false once every value has been seen.
+        ///
+        /// Runs in amortized O(1), and worst-case O(H).
+        bool next(T& value, int& priority) {
+            if (dup == nullptr) {
+                return false;
+            }
+            value = dup->value;
+            priority = node->priority;
+            dup = dup->link;
+            if (dup == nullptr) {
+                node = owner->successor(node);
+                dup = node;
+            }
+            return true;
+        }
+    };
+
+    /// Creates an empty `prqueue`.
+    /// Runs in O(1).
+    prqueue() {
+        root = nullptr;
+        sz = 0;
+        curr = nullptr;
+        temp = nullptr;
+        maxNode = nullptr;
+        maxTail = nullptr;
+        cap = 0;
+        fastPathHits = 0;
+        descents = 0;
+        rebalances = 0;
+        spineAppends = 0;
+        recorder = nullptr;
+    }
+
+    /// Creates an empty bounded `prqueue` that holds at most `capacity`
+    /// values. See `set_capacity` for details.
+    /// Runs in O(1).
+    explicit prqueue(size_t capacity) : prqueue() {
+        cap = capacity;
+    }
+
+    /// Copy constructor.
+    ///
+    /// Copies the value-priority pairs from the provided `prqueue`.
+    /// The internal tree structure must be copied exactly.
+    ///
+    /// Runs in O(N), where N is the number of values in `other`.
+    prqueue(const prqueue& other) : prqueue() {
+        *this = other;
+    }
+
+    /// Assignment operator; `operator=`.
+    ///
+    /// Clears `this` tree, and copies the value-priority pairs from the
+    /// provided `prqueue`. The internal tree structure must be copied exactly.
+    ///
+    /// Runs in O(N + O), where N is the number of values in `this`, and O is
+    /// the number of values in `other`.
+    prqueue& operator=(const prqueue& other) {
+        if (this == &other) {
+            return *this; // Avoid self-assignment
+        }
+        release();
+
+        // The capacity decides how duplicates are allocated
+        cap = other.cap;
+
+        // Call the recursive function to copy the tree structure and values
+        unique_lock<mutex> hashes(other.hashLock);
+        root = copyTree(other.root, nullptr);
+        hashes.unlock();
+        if (root != nullptr) {
+            setMax(rightmost(root));
+        }
+        sz = other.sz;
+        keyOf = other.keyOf;
+        reindex();
+        return *this;
+    }
+
+    /// Move constructor. Takes over the nodes of `other`, leaving it empty.
+    ///
+    /// Runs in O(1).
+    prqueue(prqueue&& other) : prqueue() {
+        *this = std::move(other);
+    }
+
+    /// Move assignment operator. Clears `this` tree, and takes over the nodes
+    /// of `other`, leaving it empty.
+    ///
+    /// Runs in O(N), where N is the number of values in `this`.
+    prqueue& operator=(prqueue&& other) {
+        if (this == &other) {
+            return *this;
+        }
+        release();
+
+        root = other.root;
+        sz = other.sz;
+        maxNode = other.maxNode;
+        maxTail = other.maxTail;
+        cap = other.cap;
+        spineAppends = other.spineAppends;
+        keyOf = other.keyOf;
+        index = std::move(other.index);
+        other.index.clear();
+        other.root = nullptr;
+        other.sz = 0;
+        other.maxNode = nullptr;
+        other.maxTail = nullptr;
+        other.spineAppends = 0;
+        other.curr = nullptr;
+        return *this;
+    }
+
+    /// Empties the `prqueue`, freeing all memory it controls.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    void clear() {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::clear);
+        }
+        release();
+    }
+
+    /// Destructor, cleans up all memory associated with `prqueue`.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    ~prqueue() {
+        release();
+    }
+
+    /// Adds `value` to the `prqueue` with the given `priority`.
+    ///
+    /// Uses the priority to determine the location in the underlying tree.
+    ///
+    /// If the `prqueue` is bounded and full, a value whose priority is not
+    /// smaller than the current largest priority is rejected in O(1), and
+    /// `false` is returned. Otherwise the worst value (the most recently
+    /// added value with the largest priority) is evicted, and its node is
+    /// reused for the new value.
+    ///
+    /// A priority greater than or equal to the current largest one, such as
+    /// an increasing timestamp, is appended next to the cached largest node
+    /// without descending the tree. Such appends leave a right spine behind
+    /// them; once the spine has 64 or more nodes and makes up at least half
+    /// of the `prqueue`, the next enqueue first rebalances the tree (see
+    /// `rebalance`), in O(N) amortized over the appends that built the
+    /// spine. See `stats` for how often each case happens.
+    ///
+    /// Runs in amortized O(1) for a priority at or beyond the largest one,
+    /// and O(H + M) otherwise, where H is the height of the tree, and M is
+    /// the number of duplicate priorities.
+    bool enqueue(T value, int priority) {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::enqueue, priority);
+        }
+
+        // The evicted node is reused. Every node of a bounded `prqueue` is
+        // allocated as a `HEAD`, so it fits either kind of value
+        HEAD* spare = nullptr;
+        if (cap != 0 && sz >= cap) {
+            if (priority >= maxNode->priority) {
+                return false;
+            }
+            spare = static_cast<HEAD*>(evictMax());
+        }
+
+        sz++;
+        HEAD* parent;
+        HEAD* head = locate(priority, parent);
+        if (head != nullptr) {
+            NODE* newNode = (spare != nullptr) ? spare : allocDuplicate();
+            initNode(newNode, value, priority);
+            indexAdd(newNode);
+            linkDuplicate(head, newNode);
+            return true;
+        }
+
+        HEAD* newNode = (spare != nullptr) ? spare : new HEAD;
+        initNode(newNode, value, priority);
+        newNode->count = 1;
+        indexAdd(newNode);
+        linkHead(parent, newNode);
+        return true;
+    }
+
+    /// Limits the `prqueue` to at most `capacity` values, keeping the values
+    /// with the smallest priorities. A `capacity` of 0 removes the limit.
+    ///
+    /// If the `prqueue` currently holds more than `capacity` values, the
+    /// values with the largest priorities are removed.
+    ///
+    /// While bounded, duplicate priorities are stored in nodes as large as
+    /// tree nodes (64 bytes rather than 40 in `prqueue<int>`), so the node of
+    /// an evicted value can hold any new value, and once the `prqueue` is
+    /// full, `enqueue` allocates nothing unless values are indexed (see
+    /// `index_by`). Bounding an unbounded `prqueue` reallocates the
+    /// duplicates it already holds.
+    ///
+    /// Runs in O(1) when nothing is removed or reallocated. Removing K
+    /// values takes amortized O(K), and bounding an unbounded `prqueue`
+    /// takes O(N), where N is the number of values.
+    void set_capacity(size_t capacity) {
+        if (recorder != nullptr) {
+            recorder->record_capacity(capacity);
+        }
+        if (cap == 0 && capacity != 0) {
+            cap = capacity;
+            widenDuplicates();
+        }
+        cap = capacity;
+        while (cap != 0 && sz > cap) {
+            freeNode(evictMax());
+        }
+    }
+
+    /// Returns the maximum number of values the `prqueue` holds, or 0 if it is
+    /// unbounded.
+    ///
+    /// Runs in O(1).
+    size_t capacity() const {
+        return cap;
+    }
+
+    /// Returns the value with the smallest priority in the `prqueue`, but does
+    /// not modify the `prqueue`.
+    ///
+    /// If the `prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in O(H + M), where H is the height of the tree, and M is
+    /// the number of duplicate priorities.
+    T peek() const {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::peek);
+        }
+        if (root == nullptr) {
+            return T{};
+        }
+
+        // Find the node with the lowest priority
+        NODE* current = root;
+        while (current->left != nullptr) {
+            current = current->left;
+        }
+
+        return current->value;
+    }
+
+    /// Sets `value` and `priority` to the value with the smallest priority in
+    /// the `prqueue` and its priority, but does not modify the `prqueue`.
+    /// Returns true if the reference parameters were set, and false if the
+    /// `prqueue` is empty.
+    ///
+    /// Runs in O(H), where H is the height of the tree.
+    bool peek(T& value, int& priority) const {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::peek);
+        }
+        if (root == nullptr) {
+            return false;
+        }
+        HEAD* current = leftmost(root);
+        value = current->value;
+        priority = current->priority;
+        return true;
+    }
+
+    /// Returns the value with the smallest priority in the `prqueue` and
+    /// removes it from the `prqueue`.
+    ///
+    /// If the `prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in O(H + M), where H is the height of the tree, and M is
+    /// the number of duplicate priorities.
+    T dequeue() {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::dequeue);
+        }
+        if (root == nullptr) {
+            return T();
+        }
+
+        // Find the leftmost node
+        HEAD* current = root;
+        while (current->left != nullptr) {
+            current = current->left;
+        }
+
+        T result = current->value;
+
+        // If has dupes
+        if (current->link != nullptr) {
+            shiftChain(current);
+            invalidateClass(current);
+        }
+        else {
+            removeNode(current);
+        }
+        
+        return result;
+    }
+
+    /// Returns the value with the largest priority in the `prqueue`, but does
+    /// not modify the `prqueue`. Among values with the same priority, this is
+    /// the one added last, which `dequeue` would return last. The same value
+    /// is removed by `dequeue_max`, and evicted by a full `prqueue` (see
+    /// `set_capacity`).
+    ///
+    /// If the `prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in O(1).
+    T peek_max() const {
+        if (maxNode == nullptr) {
+            return T{};
+        }
+        return maxTail->value;
+    }
+
+    /// Returns the value with the largest priority in the `prqueue` and
+    /// removes it from the `prqueue`. Among values with the same priority,
+    /// the one added last is removed, so `dequeue_max` returns the values in
+    /// the reverse of the order `dequeue` would.
+    ///
+    /// If the `prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in amortized O(1). The tail of a duplicate chain is unlinked
+    /// through its back link, and finding the next largest node walks the
+    /// right spine of the removed node's left subtree, which later calls do
+    /// not revisit.
+    T dequeue_max() {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::dequeue_max);
+        }
+        if (maxNode == nullptr) {
+            return T();
+        }
+
+        NODE* node = evictMax();
+        T result = std::move(node->value);
+        freeNode(node);
+        return result;
+    }
+
+    /// Adds every value-priority pair in `items` to the `prqueue` in a single
+    /// walk of the tree.
+    ///
+    /// The pairs are sorted by priority, keeping the order of equal
+    /// priorities, and merged into the tree from left to right, so each part
+    /// of the tree is visited at most once. New priorities that fall between
+    /// the same two existing nodes are linked in as a balanced subtree, and
+    /// duplicates of existing priorities are appended to their chains. The
+    /// resulting order of values is the same as enqueueing the sorted pairs
+    /// one at a time.
+    ///
+    /// A bounded `prqueue` (see `set_capacity`) enqueues the pairs one at a
+    /// time instead.
+    ///
+    /// Runs in O(K log K + V), where K is the number of pairs and V is the
+    /// number of nodes visited, which is at most O(K * (H + M)).
+    void enqueue_batch(vector<pair<T, int>> items) {
+        if (cap != 0) {
+            for (auto& item : items) {
+                enqueue(item.first, item.second);
+            }
+            return;
+        }
+        if (items.empty()) {
+            return;
+        }
+        if (recorder != nullptr) {
+            for (auto& item : items) {
+                recorder->record(trace_op::enqueue, item.second);
+            }
+        }
+
+        stable_sort(items.begin(), items.end(), byPriority);
+        sz += items.size();
+
+        if (root == nullptr) {
+            root = buildGroup(items, 0, items.size(), nullptr);
+            setMax(rightmost(root));
+            return;
+        }
+
+        // The path from the root to the last node visited, with the exclusive
+        // upper bound of the priorities in each node's subtree. Since the
+        // priorities only increase, a node whose bound has been passed is
+        // never visited again.
+        vector<pair<HEAD*, long long>> path;
+        path.push_back({root, LLONG_MAX});
+
+        size_t i = 0;
+        while (i < items.size()) {
+            int priority = items[i].second;
+            while (priority >= path.back().second) {
+                path.pop_back();
+            }
+
+            HEAD* current = path.back().first;
+            long long upper = path.back().second;
+            while (true) {
+                if (priority == current->priority) {
+                    while (i < items.size() && items[i].second == priority) {
+                        NODE* dup = createNode(items[i].first, priority);
+                        dup->parent = current;
+                        appendChain(current, dup, dup);
+                        indexAdd(dup);
+                        current->count++;
+                        hashAppended(current, dup->value);
+                        i++;
+                    }
+                    break;
+                }
+
+                // Everything up to the bound of the empty child goes there
+                HEAD*& child = (priority < current->priority) ? current->left : current->right;
+                long long bound = (priority < current->priority) ? current->priority : upper;
+                if (child == nullptr) {
+                    size_t end = i;
+                    while (end < items.size() && items[end].second < bound) {
+                        end++;
+                    }
+                    child = buildGroup(items, i, end, current);
+                    invalidatePath(current);
+                    i = end;
+                    break;
+                }
 
-            // Check and append duplicate values
-            NODE* current = node->link;
-            while (current != nullptr) {
-                output << node->priority << " value: " << current->value << endl;
-                current = current->link;
+                current = child;
+                upper = bound;
+                path.push_back({current, upper});
             }
-
-            _recursiveHelper(node->right, output);
         }
+
+        setMax(rightmost(maxNode));
     }
 
-    void removeNode(NODE* node) {
-        if (node == nullptr) {
+    /// Replaces the contents of the `prqueue` with the value-priority pairs in
+    /// `items`, using up to `threads` threads, or one per core if `threads`
+    /// is 0.
+    ///
+    /// The pairs are stable sorted by priority in parallel, and the tree is
+    /// built perfectly balanced, with the two subtrees of each split built
+    /// concurrently. The values end up in the same order as enqueueing the
+    /// sorted pairs one at a time. A bounded `prqueue` keeps only the
+    /// `capacity()` smallest.
+    ///
+    /// Runs in O(N log N / P + N), where N is the number of pairs and P is
+    /// the number of threads.
+    void build(vector<pair<T, int>> items, unsigned threads = 0) {
+        if (threads == 0) {
+            threads = max(1u, thread::hardware_concurrency());
+        }
+        clear();
+        if (items.empty()) {
             return;
         }
 
-        NODE* parent = node->parent;
+        parallelSort(items, 0, items.size(), threads);
 
-        // Node has no children
-        if (node->left == nullptr && node->right == nullptr) {
-            // If the node is not the root, adjust its parent's pointer
-            if (parent != nullptr) {
-                if (parent->left == node) {
-                    parent->left = nullptr;
-                }
-                else {
-                    parent->right = nullptr;
-                }
-            }
-            else {
-                // If the node is the root, update the root pointer
-                root = nullptr;
+        // Recorded as enqueueing the sorted pairs, which a bounded `prqueue`
+        // trims the same way
+        if (recorder != nullptr) {
+            for (auto& item : items) {
+                recorder->record(trace_op::enqueue, item.second);
             }
-            delete node;
         }
-        // Node has one child
-        else {
-            NODE* child = (node->left != nullptr) ? node->left : node->right;
-            // If the node is not the root, adjust its parent's pointer
-            if (parent != nullptr) {
-                if (parent->left == node) {
-                    parent->left = child;
-                }
-                else {
-                    parent->right = child;
-                }
-            }
-            else {
-                root = child;
+        if (cap != 0 && items.size() > cap) {
+            items.resize(cap);
+        }
+
+        vector<size_t> starts;
+        for (size_t i = 0; i < items.size(); i++) {
+            if (i == 0 || items[i].second != items[i - 1].second) {
+                starts.push_back(i);
             }
-            child->parent = parent;
-            delete node;
         }
-        sz--;
+        size_t classes = starts.size();
+        starts.push_back(items.size());
+
+        root = buildParallel(items, starts, 0, classes, nullptr, threads);
+        setMax(rightmost(root));
+        sz = items.size();
+        reindex();
     }
 
-    void _clear(NODE* node) {
-        if (node == nullptr) {
-            return;
+    /// Removes up to `count` values with the smallest priorities from the
+    /// `prqueue`, appending them to `out` in the order `dequeue` would return
+    /// them. Returns the number of values removed.
+    ///
+    /// The values are taken by sweeping along the left edge of the tree, so
+    /// the tree is walked once instead of once per value.
+    ///
+    /// Runs in O(K + H + M), where K is the number of values removed, H is
+    /// the height of the tree, and M is the number of duplicate priorities.
+    size_t dequeue_batch(size_t count, vector<T>& out) {
+        if (root == nullptr || count == 0) {
+            return 0;
         }
-        // Recursively clear left and right subtrees
-        _clear(node->left);
-        _clear(node->right);
-        
-        // Clear linked list of duplicates
-        while (node->link != nullptr) {
-            NODE* delVal = node->link;
-            node->link = node->link->link;
-            delete delVal;
+
+        HEAD* current = leftmost(root);
+        size_t taken = 0;
+        while (taken < count && current != nullptr) {
+            out.push_back(current->value);
+            taken++;
+            if (recorder != nullptr) {
+                recorder->record(trace_op::dequeue);
+            }
+
+            // If has dupes, the leftmost node stays in place
+            if (current->link != nullptr) {
+                shiftChain(current);
+                continue;
+            }
+
+            HEAD* next = (current->right != nullptr) ? leftmost(current->right) : current->parent;
+            detachNode(current);
+            indexRemove(current);
+            freeNode(current);
+            current = next;
         }
 
-        delete node;
+        // Every node changed by the sweep is an ancestor of the new leftmost
+        if (current != nullptr) {
+            invalidateClass(current);
+        }
+        return taken;
     }
-    
-    /// Recursive helper function to copy nodes.
-    void copyTree(NODE*& current, const NODE* otherNode) {
-        if (otherNode == nullptr) {
-            return;
+
+    /// Applies a batch of operations: adds every value-priority pair in
+    /// `enqueues`, then removes up to `dequeues` values with the smallest
+    /// priorities, appending them to `out`. Returns the number of values
+    /// removed.
+    ///
+    /// The result is the same as calling `enqueue` for each pair in order,
+    /// then `dequeue` `dequeues` times: among equal priorities, values
+    /// already in the `prqueue` come out first, then the new values in the
+    /// order given. New values that would be removed again straight away
+    /// never enter the tree. The rest are merged in like `enqueue_batch`,
+    /// and the values removed from the tree are taken like `dequeue_batch`,
+    /// so each part of the tree is visited at most once per batch.
+    ///
+    /// A bounded `prqueue` (see `set_capacity`) applies the operations one
+    /// at a time instead.
+    ///
+    /// Runs in O(K log K + D + V), where K is the number of pairs, D is the
+    /// number of values removed, and V is the number of nodes visited by
+    /// the merge, which is at most O(K * (H + M)).
+    size_t apply_batch(vector<pair<T, int>> enqueues, size_t dequeues, vector<T>& out) {
+        if (cap != 0) {
+            for (auto& item : enqueues) {
+                enqueue(item.first, item.second);
+            }
+            size_t taken = 0;
+            while (taken < dequeues && sz > 0) {
+                out.push_back(dequeue());
+                taken++;
+            }
+            return taken;
         }
-        // Copy the current node's value and priority
-        enqueue(otherNode->value, otherNode->priority);
 
-        copyTree(current->left, otherNode->left);
-        copyTree(current->right, otherNode->right);
+        stable_sort(enqueues.begin(), enqueues.end(), byPriority);
 
-        // If there's a linked list of nodes with the same priority, copy it
-        while (otherNode->link != nullptr) {
-            enqueue(otherNode->link->value, otherNode->link->priority);
-            otherNode = otherNode->link;
+        // Count the values removed from the tree and from the new pairs,
+        // walking the left edge of the tree beside the sorted pairs
+        vector<int> treePriorities;
+        size_t fromItems = 0;
+        HEAD* node = (root != nullptr) ? leftmost(root) : nullptr;
+        NODE* dup = node;
+        while (treePriorities.size() + fromItems < dequeues) {
+            bool haveItem = fromItems < enqueues.size();
+            if (dup != nullptr && (!haveItem || node->priority <= enqueues[fromItems].second)) {
+                treePriorities.push_back(node->priority);
+                dup = dup->link;
+                if (dup == nullptr) {
+                    node = successor(node);
+                    dup = node;
+                }
+            }
+            else if (haveItem) {
+                fromItems++;
+            }
+            else {
+                break;
+            }
         }
-    }
 
-    // Recursive helper function to check if two trees are equivalent.
-    bool isEqual(NODE* node1, NODE* node2) const {
-        if (!node1 && !node2) return true; // Both trees are empty
-        if (!node1 || !node2) return false; // One tree is empty, the other is not
+        trace_recorder* saved = recorder;
+        if (recorder != nullptr) {
+            for (auto& item : enqueues) {
+                recorder->record(trace_op::enqueue, item.second);
+            }
+            for (size_t i = 0; i < treePriorities.size() + fromItems; i++) {
+                recorder->record(trace_op::dequeue);
+            }
+            recorder = nullptr;
+        }
 
-        // Check if priorities and values are equal
-        if (node1->priority != node2->priority || node1->value != node2->value) return false;
+        vector<T> fromTree;
+        dequeue_batch(treePriorities.size(), fromTree);
 
-        // Recursively check left and right subtrees
-        return isEqual(node1->left, node2->left) && isEqual(node1->right, node2->right);
-    }
-    
-   public:
-    /// Creates an empty `prqueue`.
-    /// Runs in O(1).
-    prqueue() {
-        root = nullptr;
-        sz = 0;
-        curr = nullptr;
-        temp = nullptr;
-    }
+        // Merge the removed values back into priority order
+        size_t a = 0;
+        size_t b = 0;
+        while (a < fromTree.size() || b < fromItems) {
+            if (b == fromItems || (a < fromTree.size() && treePriorities[a] <= enqueues[b].second)) {
+                out.push_back(std::move(fromTree[a++]));
+            }
+            else {
+                out.push_back(std::move(enqueues[b++].first));
+            }
+        }
 
-    /// Copy constructor.
-    ///
-    /// Copies the value-priority pairs from the provided `prqueue`.
-    /// The internal tree structure must be copied exactly.
-    ///
-    /// Runs in O(N), where N is the number of values in `other`.
-    prqueue(const prqueue& other) {
-        root = nullptr;
-        copyTree(root, other.root);
-        sz = other.sz;
+        enqueues.erase(enqueues.begin(), enqueues.begin() + fromItems);
+        enqueue_batch(std::move(enqueues));
+        recorder = saved;
+        return fromTree.size() + fromItems;
     }
 
-    /// Assignment operator; `operator=`.
+    /// Moves every value with a priority greater than `priority` into a new,
+    /// unbounded `prqueue`, and returns it.
     ///
-    /// Clears `this` tree, and copies the value-priority pairs from the
-    /// provided `prqueue`. The internal tree structure must be copied exactly.
+    /// The tree is cut along the search path for `priority`, so nodes and
+    /// their duplicate chains are moved without being copied, and both trees
+    /// keep the rest of their internal structure.
     ///
-    /// Runs in O(N + O), where N is the number of values in `this`, and O is
-    /// the number of values in `other`.
-    prqueue& operator=(const prqueue& other) {
-        if (this == &other) {
-            return *this; // Avoid self-assignment
+    /// Runs in O(H + K), where H is the height of the tree, and K is the
+    /// number of values moved, which are counted.
+    prqueue split(int priority) {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::split, priority);
         }
-        clear();
+        prqueue upper;
+        HEAD* lowRoot = nullptr;
+        HEAD* highRoot = nullptr;
+        HEAD** lowHook = &lowRoot;
+        HEAD** highHook = &highRoot;
+        HEAD* lowLast = nullptr;
+        HEAD* highLast = nullptr;
 
-        // Call the recursive function to copy the tree structure and values
-        copyTree(root, other.root);
-        sz = other.sz;
-        return *this;
+        // Each node on the path goes to the side its priority belongs to,
+        // taking the subtree that cannot cross `priority` with it
+        HEAD* current = root;
+        while (current != nullptr) {
+            current->subtreeHash = 0;
+            if (current->priority <= priority) {
+                *lowHook = current;
+                current->parent = lowLast;
+                lowLast = current;
+                lowHook = &current->right;
+                current = current->right;
+            }
+            else {
+                *highHook = current;
+                current->parent = highLast;
+                highLast = current;
+                highHook = &current->left;
+                current = current->left;
+            }
+        }
+        *lowHook = nullptr;
+        *highHook = nullptr;
+
+        if (highRoot != nullptr) {
+            upper.root = highRoot;
+            upper.maxNode = maxNode;
+            upper.maxTail = maxTail;
+            upper.sz = _count(highRoot);
+            if (keyOf) {
+                upper.keyOf = keyOf;
+                upper._sweep([&](NODE* node, int) {
+                    indexRemove(node);
+                    upper.indexAdd(node);
+                });
+            }
+        }
+        root = lowRoot;
+        setMax(lowLast);
+        sz -= upper.sz;
+        return upper;
     }
 
-    /// Empties the `prqueue`, freeing all memory it controls.
+    /// Removes every value with the given `priority` and returns them in a
+    /// new, unbounded `prqueue`, in the order `dequeue` would have returned
+    /// them.
     ///
-    /// Runs in O(N), where N is the number of values.
-    void clear() {
-        _clear(root);
-        root = nullptr; // Reset the root to nullptr after clearing
-        sz = 0;
+    /// The values of a priority share one tree node and its duplicate chain,
+    /// which is unlinked as a whole and becomes the new `prqueue`, so no
+    /// value is visited, copied or moved. With an index (see `index_by`),
+    /// each value's entry moves to the new `prqueue`.
+    ///
+    /// Runs in O(H), where H is the height of the tree.
+    prqueue extract_priority(int priority) {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::extract_priority, priority);
+        }
+        prqueue result;
+        HEAD* node = findClass(priority);
+        if (node == nullptr) {
+            return result;
+        }
+        unlinkClass(node);
+        node->parent = nullptr;
+        node->left = nullptr;
+        node->right = nullptr;
+        node->subtreeHash = 0;
+
+        result.root = node;
+        result.sz = node->count;
+        result.setMax(node);
+        if (keyOf) {
+            result.keyOf = keyOf;
+            for (NODE* dup = node; dup != nullptr; dup = dup->link) {
+                indexRemove(dup);
+                result.indexAdd(dup);
+            }
+        }
+        return result;
     }
 
-    /// Destructor, cleans up all memory associated with `prqueue`.
+    /// Returns the number of values with the given `priority`.
     ///
-    /// Runs in O(N), where N is the number of values.
-    ~prqueue() {
-        clear();
+    /// Runs in O(H), where H is the height of the tree.
+    size_t count_priority(int priority) const {
+        HEAD* node = findClass(priority);
+        return (node != nullptr) ? node->count : 0;
     }
 
-    /// Adds `value` to the `prqueue` with the given `priority`.
+    /// Gives every value with priority `from` the priority `to` instead, and
+    /// returns the number of values changed.
     ///
-    /// Uses the priority to determine the location in the underlying tree.
+    /// The duplicate chain of `from` is unlinked as a whole and spliced onto
+    /// the end of the chain of `to`, after the values already there, or
+    /// becomes a new tree node if there are none. No value is copied or
+    /// reallocated, but each relinked value records its new priority.
     ///
-    /// Runs in O(H + M), where H is the height of the tree, and M is
-    /// the number of duplicate priorities.
-    void enqueue(T value, int priority) {
-        NODE* newNode = new NODE;
-        newNode->value = value;
-        newNode->priority = priority;
-        newNode->parent = nullptr;
-        newNode->left = nullptr;
-        newNode->right = nullptr;
-        newNode->link = nullptr;
-        sz++;
-
-        // If the tree is empty, the new node becomes the root
-        if (root == nullptr) {
-            root = newNode;
-            return;
+    /// Runs in O(H + M), where H is the height of the tree, and M is the
+    /// number of values with priority `from` or `to`.
+    size_t reprioritize_class(int from, int to) {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::reprioritize_class, from, to);
+        }
+        HEAD* node = findClass(from);
+        if (node == nullptr || from == to) {
+            return (node != nullptr) ? node->count : 0;
+        }
+        size_t moved = node->count;
+        unlinkClass(node);
+        node->parent = nullptr;
+        node->left = nullptr;
+        node->right = nullptr;
+        for (NODE* dup = node; dup != nullptr; dup = dup->link) {
+            dup->priority = to;
         }
 
-        // Otherwise, find where to insert the new node
-        NODE* current = root;
-        NODE* parent = nullptr;
+        HEAD* target = findClass(to);
+        if (target == nullptr) {
+            insertNode(node);
+            sz += moved;
+            return moved;
+        }
 
-        while (current != nullptr) {
-            parent = current;
-            if (priority == current->priority) {
-                while (current->link != nullptr) {
-                    current = current->link;
-                }
-                current->link = newNode;
-                newNode->parent = parent;
-                return;
-            }
-            else if (priority < current->priority) {
-                if (current->left == nullptr) {
-                    current->left = newNode;
-                    newNode->parent = parent;
-                    return;
-                }
-                current = current->left;
-            }
-            else {
-                if (current->right == nullptr) {
-                    current->right = newNode;
-                    newNode->parent = parent;
-                    return;
-                }
-                current = current->right;
-            }
+        // The tree node joins the chain as its first value
+        NODE* last = chainTail(node);
+        if (node->link != nullptr) {
+            node->link->prev = node;
+        }
+        appendChain(target, node, last);
+        for (NODE* dup = node; dup != nullptr; dup = dup->link) {
+            dup->parent = target;
         }
+        if (target == maxNode) {
+            maxTail = last;
+        }
+        target->count += moved;
+        invalidateClass(target);
+        sz += moved;
+        return moved;
     }
 
+    /// Starts indexing the values by `key(value)`, so `contains`, `find` and
+    /// `enqueue_if_absent` can look them up without walking the tree. The
+    /// index follows every operation that adds, removes or moves values,
+    /// and is copied with the `prqueue` and `split`. Several values may
+    /// share a key.
+    ///
+    /// Only available when the `prqueue` has a `Key` type, as in
+    /// `prqueue<Job, int>`.
+    ///
+    /// Runs in O(N), where N is the number of values, to index the values
+    /// already held.
+    void index_by(function<IndexKey(const T&)> key)
+        requires(!is_void_v<Key>)
+    {
+        keyOf = std::move(key);
+        reindex();
+    }
 
-    /// Returns the value with the smallest priority in the `prqueue`, but does
-    /// not modify the `prqueue`.
+    /// Returns true if a value with the given `key` is in the `prqueue`.
+    /// Always false until `index_by` is called.
     ///
-    /// If the `prqueue` is empty, returns the default value for `T`.
+    /// Runs in expected O(1).
+    bool contains(const IndexKey& key) const
+        requires(!is_void_v<Key>)
+    {
+        return index.find(key) != index.end();
+    }
+
+    /// Sets `value` and `priority` to a value with the given `key` and its
+    /// priority. Returns false, leaving them unchanged, if there is none,
+    /// or until `index_by` is called.
     ///
-    /// Runs in O(H + M), where H is the height of the tree, and M is
-    /// the number of duplicate priorities.
-    T peek() const {
-        if (root == nullptr) {
-            return T{};
+    /// Runs in expected O(1).
+    bool find(const IndexKey& key, T& value, int& priority) const
+        requires(!is_void_v<Key>)
+    {
+        auto it = index.find(key);
+        if (it == index.end()) {
+            return false;
         }
+        value = it->second->value;
+        priority = it->second->priority;
+        return true;
+    }
 
-        // Find the node with the lowest priority
-        NODE* current = root;
-        while (current->left != nullptr) {
-            current = current->left;
+    /// Adds `value` with the given `priority` unless a value with the same
+    /// key is already in the `prqueue`. Returns true if the value was added.
+    /// Without an index, this is the same as `enqueue`.
+    ///
+    /// Runs in expected O(1), plus the cost of `enqueue`.
+    bool enqueue_if_absent(T value, int priority)
+        requires(!is_void_v<Key>)
+    {
+        if (keyOf && contains(keyOf(value))) {
+            return false;
         }
-
-        return current->value;
+        return enqueue(value, priority);
     }
 
-    /// Returns the value with the smallest priority in the `prqueue` and
-    /// removes it from the `prqueue`.
+    /// Starts recording `enqueue`, `dequeue`, `peek`, `dequeue_max`,
+    /// `extract_priority`, `reprioritize_class`, `split`, `set_capacity`,
+    /// `clear` and `rebalance` calls to `rec`, including the values added
+    /// and removed by `enqueue_batch`, `dequeue_batch` and `apply_batch`.
+    /// `build` is recorded as a `clear` followed by an `enqueue` of each
+    /// pair in priority order. Automatic rebalances are not recorded, since
+    /// replaying the enqueues repeats them. Pass nullptr to stop recording.
+    /// The recorder must outlive the recording, and is not copied with the
+    /// `prqueue`, nor passed to the `prqueue`s that `split` and
+    /// `extract_priority` return.
     ///
-    /// If the `prqueue` is empty, returns the default value for `T`.
+    /// Runs in O(1).
+    void set_recorder(trace_recorder* rec) {
+        recorder = rec;
+    }
+
+    /// Rebuilds the tree perfectly balanced, keeping every node and
+    /// duplicate chain in place.
     ///
-    /// Runs in O(H + M), where H is the height of the tree, and M is
-    /// the number of duplicate priorities.
-    T dequeue() {
-        if (root == nullptr) {
-            return T();
+    /// Runs in O(N), where N is the number of values.
+    void rebalance() {
+        if (recorder != nullptr) {
+            recorder->record(trace_op::rebalance);
         }
+        rebalanceTree();
+    }
 
-        // Find the leftmost node
-        NODE* current = root;
-        while (current->left != nullptr) {
-            current = current->left;
-        }
+    /// Counters of how `enqueue` placed values, kept since the `prqueue` was
+    /// created. Returned by `stats`.
+    struct enqueue_stats {
+        size_t fast_path;   // Appended at or beyond the largest priority
+        size_t descents;    // Placed by descending from the root
+        size_t rebalances;  // Rebalances, automatic or from `rebalance`
+    };
 
-        T result = current->value;
+    /// Returns the `enqueue` counters. Values added by `build` and
+    /// `enqueue_batch` are not counted.
+    ///
+    /// Runs in O(1).
+    enqueue_stats stats() const {
+        return {fastPathHits, descents, rebalances};
+    }
 
-        // If has dupes
-        if (current->link != nullptr) {
-            temp = current->link;
-            current->value = current->link->value;
-            current->link = current->link->link;
-            delete temp;
-        }
-        else {
-            removeNode(current);
-        }
-        
-        return result;
+    /// Returns the height of the tree: the number of nodes on its longest
+    /// path from the root, not counting duplicates.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    size_t height() const {
+        return _height(root);
     }
 
     /// Returns the number of elements in the `prqueue`.
@@ -352,11 +1925,8 @@ class prqueue {
         value = curr->value;
         priority = curr->priority;
 
-        // Find largest priority node
-        temp = root;
-        while(temp->right != nullptr) {
-            temp = temp->right;
-        }
+        // Largest priority node
+        temp = maxNode;
         // If current node is largest priority (last) node && current priority is less than last priority, we're done
         if (temp == curr && curr->priority < priority) {
             return false;
@@ -439,6 +2009,105 @@ class prqueue {
         return true;    
     }
 
+    /// Returns a `view` that yields the values of the `prqueue` in the order
+    /// `as_string` lists them, one at a time, without copying the tree or
+    /// touching the `begin`/`next` state.
+    ///
+    /// Runs in O(H), where H is the height of the tree.
+    view peek_view() const {
+        return view(this, root != nullptr ? leftmost(root) : nullptr);
+    }
+
+    /// Appends the `n` values with the smallest priorities, or all of them
+    /// if there are fewer, to `out` as value-priority pairs in the order
+    /// `dequeue` would return them. The `prqueue` is not modified. Returns
+    /// the number of pairs appended.
+    ///
+    /// Runs in O(H + n), where H is the height of the tree.
+    size_t peek_n(size_t n, vector<pair<T, int>>& out) const {
+        view cursor = peek_view();
+        T value;
+        int priority;
+        size_t taken = 0;
+        while (taken < n && cursor.next(value, priority)) {
+            out.push_back({value, priority});
+            taken++;
+        }
+        return taken;
+    }
+
+    /// Returns the value-priority pairs of the `prqueue` in the order
+    /// `as_string` lists them, in a form `build` and `enqueue_batch` accept.
+    ///
+    /// Runs in O(N), where N is the number of values, in a single iterative
+    /// sweep.
+    vector<pair<T, int>> to_vector() const& {
+        vector<pair<T, int>> result;
+        result.reserve(sz);
+        _sweep([&result](NODE* node, int priority) { result.push_back({node->value, priority}); });
+        return result;
+    }
+
+    /// Same as `to_vector() const&`, but moves the values out of a
+    /// `prqueue` that is about to be destroyed, leaving it empty.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    vector<pair<T, int>> to_vector() && {
+        vector<pair<T, int>> result;
+        result.reserve(sz);
+        _sweep([&result](NODE* node, int priority) { result.push_back({std::move(node->value), priority}); });
+        release();
+        return result;
+    }
+
+    /// Appends the priorities and values of the `prqueue`, in the order
+    /// `as_string` lists them, to `priority_out` and `value_out`.
+    ///
+    /// Runs in O(N), where N is the number of values, in a single iterative
+    /// sweep.
+    void export_sorted(vector<int>& priority_out, vector<T>& value_out) const& {
+        priority_out.reserve(priority_out.size() + sz);
+        value_out.reserve(value_out.size() + sz);
+        _sweep([&](NODE* node, int priority) {
+            priority_out.push_back(priority);
+            value_out.push_back(node->value);
+        });
+    }
+
+    /// Same as `export_sorted(...) const&`, but moves the values out of a
+    /// `prqueue` that is about to be destroyed, leaving it empty.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    void export_sorted(vector<int>& priority_out, vector<T>& value_out) && {
+        priority_out.reserve(priority_out.size() + sz);
+        value_out.reserve(value_out.size() + sz);
+        _sweep([&](NODE* node, int priority) {
+            priority_out.push_back(priority);
+            value_out.push_back(std::move(node->value));
+        });
+        release();
+    }
+
+    /// Returns a `frozen` snapshot of the `prqueue`, whose `priorities()` and
+    /// `values()` can then be read sequentially.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    frozen freeze() const& {
+        frozen result;
+        export_sorted(result.prios, result.vals);
+        return result;
+    }
+
+    /// Same as `freeze() const&`, but moves the values out of a `prqueue`
+    /// that is about to be destroyed, leaving it empty.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    frozen freeze() && {
+        frozen result;
+        std::move(*this).export_sorted(result.prios, result.vals);
+        return result;
+    }
+
     /// Converts the `prqueue` to a string representation, with the values
     /// in-order by priority.
     ///
@@ -469,6 +2138,33 @@ class prqueue {
         return result.str();
     }
 
+    /// Same as `as_string()`, but builds the text of independent subtrees on
+    /// up to `threads` threads, or one per core if `threads` is 0.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    string as_string(unsigned threads) const {
+        if (threads == 0) {
+            threads = max(1u, thread::hardware_concurrency());
+        }
+        return _parallelString(root, threads);
+    }
+
+    /// Calls `fn(value, priority)` for every value in the `prqueue`.
+    ///
+    /// With more than one thread, independent subtrees are visited
+    /// concurrently, so `fn` must be safe to call from several threads at
+    /// once, and the calls are not in priority order. With one thread, the
+    /// calls are in the order `as_string` lists the values.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    template <typename Fn>
+    void for_each(Fn fn, unsigned threads = 1) const {
+        if (threads == 0) {
+            threads = max(1u, thread::hardware_concurrency());
+        }
+        _forEach(root, fn, threads);
+    }
+
     /// Checks if the contents of `this` and `other` are equivalent.
     ///
     /// Two `prqueues` are equivalent if they have the same priorities and
@@ -504,13 +2200,43 @@ class prqueue {
     /// a.enqueue("3", 3);
     /// ```
     ///
-    /// Runs in O(N) time, where N is the maximum number of nodes in
-    /// either `prqueue`.
+    /// Duplicate chains must also hold the same values in the same order.
+    ///
+    /// The automatic rebalancing described in `enqueue` changes the tree
+    /// structure, so it can make otherwise equal `prqueue`s differ.
+    ///
+    /// `prqueue`s with different sizes or fingerprints are rejected in O(1).
+    /// Otherwise, runs in O(N) time, where N is the maximum number of nodes
+    /// in either `prqueue`.
     ///
     bool operator==(const prqueue& other) const {
+        if (sz != other.sz || fingerprint() != other.fingerprint()) {
+            return false;
+        }
         return isEqual(root, other.root);
     }
 
+    /// Returns a hash of the priorities, values and internal tree structure
+    /// of the `prqueue`. Equivalent `prqueue`s (see `operator==`) always
+    /// have the same fingerprint, so a changed fingerprint means the
+    /// contents changed. Values of a type without a `hash` specialization
+    /// do not contribute.
+    ///
+    /// Operations mark the path they touch as changed, and the fingerprint
+    /// rehashes only the changed nodes. The rehashed nodes are cached under
+    /// a lock, so like other const functions, `fingerprint` and
+    /// `operator==` can be called from several threads at once, as long as
+    /// nothing modifies the `prqueue` meanwhile.
+    ///
+    /// Runs in O(1) if the `prqueue` has not changed since the last call, and
+    /// O(C + D) otherwise, where C is the number of nodes changed since, and
+    /// D is the number of values in the priorities that lost a value.
+    size_t fingerprint() const {
+        lock_guard<mutex> guard(hashLock);
+        refreshHashes();
+        return root != nullptr ? root->subtreeHash : 0;
+    }
+
     /// Returns a pointer to the root node of the BST.
     ///
     /// Used for testing the internal structure of the BST. Do not edit or
@@ -0,0 +1,110 @@
+#include "prqueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+
+using namespace std;
+
+// Returns the milliseconds taken by `fn`.
+template <typename Fn>
+double timeMs(Fn fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Parallel build and traversal: build, as_string and for_each over N values
+// with 1 to 16 threads.
+void benchParallel(size_t n) {
+    mt19937 rng(42);
+    uniform_int_distribution<int> priorities(0, 1 << 30);
+    vector<pair<int, int>> items(n);
+    for (size_t i = 0; i < n; i++) {
+        items[i] = {static_cast<int>(i), priorities(rng)};
+    }
+
+    cout << "parallel build/traversal, N = " << n << endl;
+    cout << "threads\tbuild ms\tas_string ms\tfor_each ms" << endl;
+    for (unsigned threads : {1u, 2u, 4u, 8u, 16u}) {
+        prqueue<int> pq;
+        double build = timeMs([&] { pq.build(items, threads); });
+
+        size_t length = 0;
+        double text = timeMs([&] { length = pq.as_string(threads).size(); });
+
+        atomic<long long> sum{0};
+        double visit = timeMs([&] {
+            pq.for_each([&sum](const int& value, int) { sum.fetch_add(value, memory_order_relaxed); }, threads);
+        });
+
+        cout << threads << "\t" << build << "\t" << text << "\t" << visit << endl;
+        if (length == 0 || sum == 0) {
+            cout << "unexpected empty result" << endl;
+        }
+    }
+}
+
+// Mixed batches: from a queue of N values, apply ticks of 4096 enqueues and
+// 4096 dequeues with per-op calls and with apply_batch.
+void benchApplyBatch(size_t n) {
+    const size_t batch = 4096;
+    const int ticks = 64;
+    mt19937 rng(7);
+    uniform_int_distribution<int> priorities(0, 1 << 30);
+    vector<pair<int, int>> initial(n);
+    for (size_t i = 0; i < n; i++) {
+        initial[i] = {static_cast<int>(i), priorities(rng)};
+    }
+    vector<vector<pair<int, int>>> batches(ticks, vector<pair<int, int>>(batch));
+    for (auto& items : batches) {
+        for (auto& item : items) {
+            item = {0, priorities(rng)};
+        }
+    }
+
+    prqueue<int> single;
+    single.build(initial, 1);
+    long long singleSum = 0;
+    double perOp = timeMs([&] {
+        for (auto& items : batches) {
+            for (auto& item : items) {
+                single.enqueue(item.first, item.second);
+            }
+            for (size_t i = 0; i < batch; i++) {
+                singleSum += single.dequeue();
+            }
+        }
+    });
+
+    prqueue<int> batched;
+    batched.build(initial, 1);
+    long long batchedSum = 0;
+    double applied = timeMs([&] {
+        vector<int> out;
+        for (auto& items : batches) {
+            out.clear();
+            batched.apply_batch(items, batch, out);
+            for (int value : out) {
+                batchedSum += value;
+            }
+        }
+    });
+
+    cout << "mixed batches, N = " << n << ", " << ticks << " ticks of " << batch << " enqueues and dequeues"
+         << endl;
+    cout << "per-op ms\tapply_batch ms" << endl;
+    cout << perOp << "\t" << applied << endl;
+    if (singleSum != batchedSum) {
+        cout << "results differ" << endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    benchParallel(n);
+    cout << endl;
+    benchApplyBatch(n);
+    return 0;
+}
@@ -0,0 +1,204 @@
+// Replays a trace recorded with `prqueue::set_recorder` against a chosen
+// queue configuration, and reports throughput, per-operation latency
+// percentiles and the final tree height.
+//
+// Usage: prqueue_replay TRACE [--impl prqueue|persistent|compact]
+//                             [--capacity N] [--repeat R]
+//
+// Enqueued values are replaced by their position in the trace, since the
+// trace records only priorities. --capacity applies to prqueue only, as do
+// traces that use dequeue_max, extract_priority, reprioritize_class, split,
+// set_capacity or rebalance.
+
+#include "compact_prqueue.h"
+#include "persistent_prqueue.h"
+#include "prqueue.h"
+#include "prqueue_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <type_traits>
+
+using namespace std;
+
+struct Options {
+    string path;
+    string impl = "prqueue";
+    size_t capacity = 0;
+    int repeat = 1;
+};
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--impl") == 0 && hasValue) {
+            options.impl = argv[++i];
+        }
+        else if (strcmp(argv[i], "--capacity") == 0 && hasValue) {
+            options.capacity = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && hasValue) {
+            options.repeat = max(1, atoi(argv[++i]));
+        }
+        else if (argv[i][0] != '-' && options.path.empty()) {
+            options.path = argv[i];
+        }
+        else {
+            return false;
+        }
+    }
+    if (options.impl != "prqueue" && options.impl != "persistent" && options.impl != "compact") {
+        return false;
+    }
+    // Only prqueue has a bounded mode
+    if (options.impl != "prqueue" && options.capacity != 0) {
+        return false;
+    }
+    return !options.path.empty();
+}
+
+// Nanosecond latencies of one kind of operation.
+struct Latencies {
+    const char* name;
+    vector<uint64_t> samples;
+
+    void report() {
+        if (samples.empty()) {
+            return;
+        }
+        sort(samples.begin(), samples.end());
+        auto at = [this](double q) { return samples[min(samples.size() - 1, size_t(q * samples.size()))]; };
+        cout << left << setw(8) << name << right << setw(10) << samples.size() << setw(10) << at(0.5)
+             << setw(10) << at(0.9) << setw(10) << at(0.99) << setw(10) << at(0.999) << setw(12) << samples.back()
+             << endl;
+    }
+};
+
+const int OPS = static_cast<int>(trace_op::rebalance) + 1;
+
+// Returns true if only prqueue can replay `op`.
+bool prqueueOnly(trace_op op) {
+    return op != trace_op::enqueue && op != trace_op::dequeue && op != trace_op::peek && op != trace_op::clear;
+}
+
+template <typename Queue>
+void replay(Queue& pq, const vector<trace_record>& records, Latencies (&latencies)[OPS]) {
+    int value = 0;
+    for (const trace_record& record : records) {
+        auto start = chrono::steady_clock::now();
+        switch (record.op) {
+            case trace_op::enqueue:
+                pq.enqueue(value++, record.priority);
+                break;
+            case trace_op::dequeue:
+                pq.dequeue();
+                break;
+            case trace_op::peek:
+                pq.peek();
+                break;
+            case trace_op::clear:
+                pq.clear();
+                break;
+            default:
+                if constexpr (is_same_v<Queue, prqueue<int>>) {
+                    if (record.op == trace_op::dequeue_max) {
+                        pq.dequeue_max();
+                    }
+                    else if (record.op == trace_op::extract_priority) {
+                        pq.extract_priority(record.priority);
+                    }
+                    else if (record.op == trace_op::reprioritize_class) {
+                        pq.reprioritize_class(record.priority, record.target);
+                    }
+                    else if (record.op == trace_op::set_capacity) {
+                        pq.set_capacity(record.capacity);
+                    }
+                    else if (record.op == trace_op::rebalance) {
+                        pq.rebalance();
+                    }
+                    else {
+                        pq.split(record.priority);
+                    }
+                }
+                break;
+        }
+        auto elapsed = chrono::steady_clock::now() - start;
+        latencies[static_cast<int>(record.op)].samples.push_back(
+            chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        cerr << "usage: " << argv[0] << " TRACE [--impl prqueue|persistent|compact] [--capacity N] [--repeat R]" << endl;
+        return 2;
+    }
+
+    ifstream file(options.path, ios::binary);
+    trace_reader reader(file);
+    if (!reader.ok()) {
+        cerr << options.path << ": not a prqueue trace" << endl;
+        return 1;
+    }
+    vector<trace_record> records;
+    trace_record record;
+    bool extended = false;
+    while (reader.next(record)) {
+        records.push_back(record);
+        extended = extended || prqueueOnly(record.op);
+    }
+    if (extended && options.impl != "prqueue") {
+        cerr << options.path << ": trace uses operations only prqueue supports" << endl;
+        return 1;
+    }
+
+    Latencies latencies[OPS] = {{"enqueue", {}}, {"dequeue", {}}, {"peek", {}},     {"max", {}},
+                                {"extract", {}}, {"reprio", {}},  {"split", {}},    {"capacity", {}},
+                                {"clear", {}},   {"rebal", {}}};
+    size_t finalSize = 0;
+    size_t finalHeight = 0;
+    auto start = chrono::steady_clock::now();
+    for (int round = 0; round < options.repeat; round++) {
+        if (options.impl == "persistent") {
+            persistent_prqueue<int> pq;
+            replay(pq, records, latencies);
+            finalSize = pq.size();
+            finalHeight = pq.height();
+        }
+        else if (options.impl == "compact") {
+            compact_prqueue<int> pq;
+            replay(pq, records, latencies);
+            finalSize = pq.size();
+            finalHeight = pq.height();
+        }
+        else {
+            prqueue<int> pq(options.capacity);
+            replay(pq, records, latencies);
+            finalSize = pq.size();
+            finalHeight = pq.height();
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t operations = records.size() * options.repeat;
+    cout << "trace:      " << options.path << " (" << records.size() << " operations)" << endl;
+    cout << "impl:       " << options.impl;
+    if (options.capacity != 0) {
+        cout << ", capacity " << options.capacity;
+    }
+    cout << endl;
+    cout << "throughput: " << fixed << setprecision(0) << operations / seconds << " ops/s" << endl;
+    cout << "final:      size " << finalSize << ", height " << finalHeight << endl;
+    cout << endl;
+    cout << left << setw(8) << "op" << right << setw(10) << "count" << setw(10) << "p50 ns" << setw(10)
+         << "p90 ns" << setw(10) << "p99 ns" << setw(10) << "p99.9 ns" << setw(12) << "max ns" << endl;
+    for (Latencies& latency : latencies) {
+        latency.report();
+    }
+    return 0;
+}
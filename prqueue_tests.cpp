@@ -1,9 +1,90 @@
 #include "prqueue.h"
+#include "static_prqueue.h"
+#include "compact_prqueue.h"
+#include "external_prqueue.h"
+#include "merged_view.h"
+#include "work_stealing_prqueue.h"
+#include "blocking_prqueue.h"
+#include "async_prqueue.h"
+#include "persistent_prqueue.h"
+#include "shm_prqueue.h"
+#include "timer_prqueue.h"
 
 #include "gtest/gtest.h"
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
 #include <queue>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
 
 using namespace std;
+
+// Counts the allocations made while `countingAllocations` is set. Every
+// form of `new` and `delete` is replaced, so they all pair up.
+atomic<bool> countingAllocations{false};
+atomic<size_t> allocations{0};
+
+void* countedAlloc(size_t size) noexcept {
+    if (countingAllocations) {
+        allocations++;
+    }
+    return malloc(size != 0 ? size : 1);
+}
+
+void* operator new(size_t size) {
+    void* p = countedAlloc(size);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+// GCC sees `free` on memory from `new` once these are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) noexcept {
+    free(p);
+}
+
+#pragma GCC diagnostic pop
+
 TEST(ConstructorTest, DefaultConstructor) {
     prqueue<int> pq;
     EXPECT_EQ(pq.size(), 0);
@@ -631,3 +712,2026 @@ TEST(EqualOPTest, NotEqualDifferentStructure) {
     queue2.enqueue("banana", 5);
     ASSERT_FALSE(queue1 == queue2);
 }
+
+TEST(CapacityTest, KeepsSmallestK) {
+    prqueue<int> pq(3);
+    EXPECT_EQ(pq.capacity(), 3);
+
+    EXPECT_TRUE(pq.enqueue(50, 5));
+    EXPECT_TRUE(pq.enqueue(10, 1));
+    EXPECT_TRUE(pq.enqueue(40, 4));
+    EXPECT_FALSE(pq.enqueue(60, 6));    // Worse than the current worst
+    EXPECT_FALSE(pq.enqueue(51, 5));    // Ties with the current worst
+    EXPECT_TRUE(pq.enqueue(20, 2));     // Evicts 50
+    EXPECT_TRUE(pq.enqueue(30, 3));     // Evicts 40
+
+    EXPECT_EQ(pq.size(), 3);
+    EXPECT_EQ(pq.as_string(), "1 value: 10\n2 value: 20\n3 value: 30\n");
+}
+
+TEST(CapacityTest, EvictsDuplicateTail) {
+    prqueue<string> pq(3);
+    pq.enqueue("a", 1);
+    pq.enqueue("b", 2);
+    pq.enqueue("c", 2);
+    pq.enqueue("d", 0);     // Evicts "c", the last value with priority 2
+
+    EXPECT_EQ(pq.as_string(), "0 value: d\n1 value: a\n2 value: b\n");
+
+    pq.enqueue("e", 0);     // Evicts "b", and with it the largest node
+    EXPECT_FALSE(pq.enqueue("f", 1));  // Ties with "a", the worst
+    EXPECT_EQ(pq.as_string(), "0 value: d\n0 value: e\n1 value: a\n");
+}
+
+TEST(CapacityTest, ShrinkAndUnbound) {
+    prqueue<int> pq;
+    for (int i = 0; i < 10; i++) {
+        pq.enqueue(i, (i * 7) % 10);
+    }
+    pq.set_capacity(4);
+    EXPECT_EQ(pq.size(), 4);
+    EXPECT_EQ(pq.as_string(), "0 value: 0\n1 value: 3\n2 value: 6\n3 value: 9\n");
+
+    pq.set_capacity(0);
+    EXPECT_TRUE(pq.enqueue(100, 100));
+    EXPECT_EQ(pq.size(), 5);
+
+    prqueue<int> copy(pq);
+    EXPECT_EQ(copy.capacity(), 0);
+    EXPECT_EQ(copy.as_string(), pq.as_string());
+}
+
+TEST(CapacityTest, FullQueueDoesNotAllocate) {
+    // Duplicates added before the bound are reallocated by it
+    prqueue<int> pq;
+    for (int i = 0; i < 200; i++) {
+        pq.enqueue(i, i % 5);
+    }
+    pq.set_capacity(100);
+
+    // New priorities and duplicates mixed, so evicted duplicates become
+    // tree nodes and the other way round
+    size_t accepted = 0;
+    allocations = 0;
+    countingAllocations = true;
+    for (int i = 0; i < 20000; i++) {
+        int priority = (i % 3 == 0) ? -i : (i * 7919) % 40 - 20;
+        accepted += pq.enqueue(i, priority);
+    }
+    countingAllocations = false;
+    EXPECT_EQ(allocations, 0);
+    EXPECT_GT(accepted, 5000);
+    EXPECT_EQ(pq.size(), 100);
+}
+
+TEST(CapacityTest, MatchesSortedModel) {
+    // Evicted duplicates, tree nodes, and tree nodes that joined another
+    // chain are all reused or freed along the way
+    prqueue<int> pq(20);
+    vector<pair<int, int>> model;  // Sorted by priority, then by arrival
+    auto place = [&model](int value, int priority) {
+        auto it = upper_bound(model.begin(), model.end(), priority,
+                              [](int p, const pair<int, int>& item) { return p < item.first; });
+        model.insert(it, {priority, value});
+    };
+    for (int i = 0; i < 3000; i++) {
+        int priority = (i * 7919) % 13;
+        if (i % 10 == 9) {
+            int from = (i * 31) % 13;
+            int to = (i * 17) % 13;
+            vector<pair<int, int>> moved;
+            for (auto it = model.begin(); it != model.end();) {
+                if (it->first == from) {
+                    moved.push_back(*it);
+                    it = model.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+            for (auto& item : moved) {
+                place(item.second, to);
+            }
+            EXPECT_EQ(pq.reprioritize_class(from, to), moved.size());
+        }
+        else if (i % 7 == 6 && !model.empty()) {
+            EXPECT_EQ(pq.dequeue(), model.front().second);
+            model.erase(model.begin());
+        }
+        else {
+            bool fits = model.size() < 20 || priority < model.back().first;
+            EXPECT_EQ(pq.enqueue(i, priority), fits);
+            if (fits) {
+                if (model.size() == 20) {
+                    model.pop_back();
+                }
+                place(i, priority);
+            }
+        }
+        ASSERT_EQ(pq.size(), model.size());
+    }
+
+    ostringstream expected;
+    for (auto& item : model) {
+        expected << item.first << " value: " << item.second << endl;
+    }
+    EXPECT_EQ(pq.as_string(), expected.str());
+}
+
+TEST(DequeueMaxTest, EmptyQueue) {
+    prqueue<int> pq;
+    EXPECT_EQ(pq.peek_max(), 0);
+    EXPECT_EQ(pq.dequeue_max(), 0);
+}
+
+TEST(DequeueMaxTest, BothEnds) {
+    prqueue<int> pq;
+    pq.enqueue(1, 0);
+    pq.enqueue(2, -3);
+    pq.enqueue(3, 5);
+    pq.enqueue(4, 3);
+    pq.enqueue(5, 4);
+    pq.enqueue(6, 5);
+    pq.enqueue(7, -1);
+
+    // The last value added with the largest priority goes first
+    EXPECT_EQ(pq.peek_max(), 6);
+    EXPECT_EQ(pq.dequeue_max(), 6);
+    EXPECT_EQ(pq.dequeue_max(), 3);
+    EXPECT_EQ(pq.size(), 5);
+    EXPECT_EQ(pq.dequeue(), 2);
+    EXPECT_EQ(pq.dequeue_max(), 5);
+    EXPECT_EQ(pq.dequeue_max(), 4);
+    EXPECT_EQ(pq.peek_max(), 1);
+    EXPECT_EQ(pq.dequeue(), 7);
+    EXPECT_EQ(pq.dequeue_max(), 1);
+    EXPECT_EQ(pq.size(), 0);
+    EXPECT_EQ(pq.getRoot(), nullptr);
+}
+
+TEST(DequeueMaxTest, NextAfterDequeueMax) {
+    prqueue<int> pq;
+    for (int i = 0; i < 8; i++) {
+        pq.enqueue(i, (i * 5) % 8);
+    }
+    pq.dequeue_max();
+    pq.dequeue_max();
+
+    int value;
+    int priority;
+    int last = -1;
+    pq.begin();
+    for (size_t i = 0; i < pq.size(); i++) {
+        EXPECT_TRUE(pq.next(value, priority));
+        EXPECT_GT(priority, last);
+        last = priority;
+    }
+    EXPECT_FALSE(pq.next(value, priority));
+    EXPECT_EQ(last, 5);
+}
+
+TEST(DequeueMaxTest, DrainsLongChain) {
+    // 200k duplicates: a chain walk per call would take ~10^10 steps
+    const int n = 200000;
+    prqueue<int> pq;
+    pq.enqueue(-1, 1);
+    for (int i = 0; i < n; i++) {
+        pq.enqueue(i, 7);
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        ASSERT_EQ(pq.peek_max(), i);
+        ASSERT_EQ(pq.dequeue_max(), i);
+        if (i % 50000 == 0) {
+            prqueue<int> copy(pq);
+            EXPECT_EQ(copy.fingerprint(), pq.fingerprint());
+            pq.enqueue(n, 7);
+            EXPECT_EQ(pq.dequeue_max(), n);
+        }
+    }
+    EXPECT_EQ(pq.size(), 1);
+    EXPECT_EQ(pq.dequeue_max(), -1);
+    EXPECT_EQ(pq.size(), 0);
+}
+
+TEST(TimerTest, AdvanceFiresInTickOrder) {
+    timer_prqueue<int> timers;
+    timers.enqueue(1, 5);
+    timers.enqueue(2, 70);
+    timers.enqueue(3, 64);
+    timers.enqueue(4, 5000);
+    timers.enqueue(5, 3);
+    timers.enqueue(6, 70);
+
+    vector<int> fired;
+    EXPECT_EQ(timers.advance_to(2, fired), 0);
+    EXPECT_EQ(timers.advance_to(64, fired), 3);
+    EXPECT_EQ(fired, vector<int>({5, 1, 3}));
+    EXPECT_EQ(timers.now(), 64);
+
+    timers.advance_to(10000, fired);
+    EXPECT_EQ(fired, vector<int>({5, 1, 3, 2, 6, 4}));
+    EXPECT_EQ(timers.size(), 0);
+}
+
+TEST(TimerTest, EqualTicksStayFirstInFirstOut) {
+    // The first of each pair cascades down through the levels, and the
+    // second is placed once the current tick is close
+    timer_prqueue<int> timers;
+    for (int i = 0; i < 6; i++) {
+        timers.enqueue(i, 5000 + i % 3);
+    }
+    vector<int> fired;
+    timers.advance_to(4097, fired);
+    for (int i = 6; i < 12; i++) {
+        timers.enqueue(i, 5000 + i % 3);
+    }
+    EXPECT_EQ(timers.peek(), 0);
+    EXPECT_EQ(timers.dequeue(), 0);
+    EXPECT_EQ(timers.dequeue(), 3);
+    EXPECT_EQ(timers.dequeue(), 6);
+
+    timers.advance_to(5001, fired);
+    EXPECT_EQ(fired, vector<int>({9, 1, 4, 7, 10}));
+    fired.clear();
+    timers.advance_to(6000, fired);
+    EXPECT_EQ(fired, vector<int>({2, 5, 8, 11}));
+}
+
+TEST(TimerTest, CancelAndOverdue) {
+    timer_prqueue<string> timers(100);
+    size_t a = timers.enqueue("a", 150);
+    timers.enqueue("b", 300);
+    timers.enqueue("late", 90);
+
+    EXPECT_TRUE(timers.cancel(a));
+    EXPECT_FALSE(timers.cancel(a));
+    EXPECT_EQ(timers.size(), 2);
+
+    vector<string> fired;
+    timers.advance_to(200, fired);
+    EXPECT_EQ(fired, vector<string>({"late"}));
+    EXPECT_EQ(timers.peek(), "b");
+}
+
+TEST(TimerTest, DequeueMatchesPrqueue) {
+    timer_prqueue<int> timers(-1000);
+    prqueue<int> pq;
+    for (int i = 0; i < 500; i++) {
+        int tick = (i * 7919) % 100003 - 500;
+        timers.enqueue(i, tick);
+        pq.enqueue(i, tick);
+    }
+
+    vector<int> fired;
+    timers.advance_to(0, fired);
+    for (int value : fired) {
+        EXPECT_EQ(value, pq.dequeue());
+    }
+    while (pq.size() > 0) {
+        EXPECT_EQ(timers.dequeue(), pq.dequeue());
+    }
+    EXPECT_EQ(timers.size(), 0);
+    EXPECT_EQ(timers.dequeue(), 0);
+}
+
+TEST(PersistentTest, MatchesPrqueue) {
+    persistent_prqueue<string> names;
+    prqueue<string> expected;
+    string values[] = {"Zack", "Mack", "Jack", "Isack", "Tack", "Pack"};
+    int priorities[] = {3, 2, 1, 2, 1, 0};
+    for (int i = 0; i < 6; i++) {
+        names.enqueue(values[i], priorities[i]);
+        expected.enqueue(values[i], priorities[i]);
+    }
+
+    EXPECT_EQ(names.size(), 6);
+    EXPECT_EQ(names.as_string(), expected.as_string());
+    while (expected.size() > 0) {
+        EXPECT_EQ(names.peek(), expected.peek());
+        EXPECT_EQ(names.dequeue(), expected.dequeue());
+    }
+    EXPECT_EQ(names.size(), 0);
+    EXPECT_EQ(names.dequeue(), "");
+}
+
+TEST(PersistentTest, CopiesAreIndependentSnapshots) {
+    persistent_prqueue<int> pq;
+    for (int i = 0; i < 10; i++) {
+        pq.enqueue(i, (i * 3) % 10);
+    }
+
+    persistent_prqueue<int> snapshot(pq);
+    EXPECT_TRUE(snapshot == pq);
+    string before = snapshot.as_string();
+
+    pq.dequeue();
+    pq.enqueue(100, 4);
+    pq.enqueue(101, 20);
+    EXPECT_FALSE(snapshot == pq);
+    EXPECT_EQ(snapshot.as_string(), before);
+    EXPECT_EQ(snapshot.size(), 10);
+    EXPECT_EQ(pq.size(), 11);
+
+    // Iterating a snapshot is unaffected by later changes to the original
+    persistent_prqueue<int> copy;
+    copy = pq;
+    copy.begin();
+    pq.clear();
+    int value;
+    int priority;
+    int count = 0;
+    int last = -1;
+    while (copy.next(value, priority)) {
+        EXPECT_GE(priority, last);
+        last = priority;
+        count++;
+    }
+    EXPECT_EQ(count, 11);
+    EXPECT_EQ(last, 20);
+}
+
+TEST(PersistentTest, DuplicatesKeepTheirOrder) {
+    persistent_prqueue<int> pq;
+    prqueue<int> expected;
+    for (int i = 0; i < 1000; i++) {
+        pq.enqueue(i, i % 3);
+        expected.enqueue(i, i % 3);
+    }
+    persistent_prqueue<int> snapshot(pq);
+    EXPECT_EQ(pq.as_string(), expected.as_string());
+
+    // Interleave dequeues with appends to the same class
+    for (int i = 0; i < 500; i++) {
+        EXPECT_EQ(pq.dequeue(), expected.dequeue());
+        pq.enqueue(1000 + i, 0);
+        expected.enqueue(1000 + i, 0);
+    }
+    EXPECT_EQ(pq.as_string(), expected.as_string());
+    EXPECT_EQ(snapshot.size(), 1000);
+    EXPECT_EQ(snapshot.dequeue(), 0);
+    EXPECT_EQ(snapshot.dequeue(), 3);
+
+    persistent_prqueue<int> copy(pq);
+    EXPECT_TRUE(copy == pq);
+    copy.dequeue();
+    copy.enqueue(-1, 2);
+    pq.enqueue(-1, 2);
+    pq.dequeue();
+    EXPECT_TRUE(copy == pq);
+    expected.enqueue(-1, 2);
+    expected.dequeue();
+    while (expected.size() > 0) {
+        EXPECT_EQ(pq.dequeue(), expected.dequeue());
+    }
+}
+
+TEST(PersistentTest, SortedInputStaysShallow) {
+    persistent_prqueue<int> pq;
+    for (int i = 0; i < 100000; i++) {
+        pq.enqueue(i, i);
+    }
+    persistent_prqueue<int> snapshot(pq);
+    EXPECT_LT(pq.height(), 60);
+
+    // The shape only depends on the priorities held
+    persistent_prqueue<int> reversed;
+    for (int i = 99999; i >= 0; i--) {
+        reversed.enqueue(i, i);
+    }
+    EXPECT_TRUE(reversed == pq);
+
+    for (int i = 0; i < 50000; i++) {
+        EXPECT_EQ(pq.dequeue(), i);
+    }
+    EXPECT_LT(pq.height(), 60);
+    EXPECT_EQ(snapshot.peek(), 0);
+    EXPECT_EQ(snapshot.size(), 100000);
+}
+
+TEST(PersistentTest, ReleasesLongChains) {
+    // Freeing a chain link by link used to recurse once per link
+    persistent_prqueue<int> copy;
+    {
+        persistent_prqueue<int> pq;
+        for (int i = 0; i < 1000000; i++) {
+            pq.enqueue(i, 5);
+        }
+        pq.dequeue();
+        copy = pq;
+        for (int i = 0; i < 1000000; i++) {
+            pq.enqueue(i, 6);
+        }
+    }
+    EXPECT_EQ(copy.size(), 999999);
+    EXPECT_EQ(copy.dequeue(), 1);
+    copy.clear();
+    EXPECT_EQ(copy.size(), 0);
+}
+
+TEST(FingerprintTest, TracksContentsAndStructure) {
+    prqueue<string> a;
+    prqueue<string> b;
+    EXPECT_EQ(a.fingerprint(), b.fingerprint());
+
+    a.enqueue("2", 2);
+    a.enqueue("1", 1);
+    a.enqueue("3", 3);
+    b.enqueue("2", 2);
+    b.enqueue("3", 3);
+    b.enqueue("1", 1);
+    EXPECT_EQ(a.fingerprint(), b.fingerprint());
+    EXPECT_TRUE(a == b);
+
+    size_t before = a.fingerprint();
+    a.enqueue("4", 4);
+    EXPECT_NE(a.fingerprint(), before);
+    a.dequeue_max();
+    EXPECT_EQ(a.fingerprint(), before);
+
+    prqueue<string> c;
+    c.enqueue("1", 1);
+    c.enqueue("2", 2);
+    c.enqueue("3", 3);
+    EXPECT_NE(a.fingerprint(), c.fingerprint());
+    EXPECT_FALSE(a == c);
+}
+
+TEST(FingerprintTest, ComparesDuplicateChains) {
+    prqueue<int> a;
+    prqueue<int> b;
+    a.enqueue(10, 1);
+    a.enqueue(20, 1);
+    a.enqueue(30, 1);
+    b.enqueue(10, 1);
+    b.enqueue(30, 1);
+    b.enqueue(20, 1);
+    EXPECT_FALSE(a == b);
+
+    a.dequeue();
+    b.dequeue();
+    b.dequeue();
+    b.enqueue(30, 1);
+    EXPECT_TRUE(a == b);
+    EXPECT_EQ(a.fingerprint(), b.fingerprint());
+
+    prqueue<int> copy(a);
+    EXPECT_TRUE(copy == a);
+    copy.dequeue();
+    copy.enqueue(20, 1);
+    EXPECT_FALSE(copy == a);
+}
+
+TEST(FingerprintTest, ConcurrentReaders) {
+    prqueue<int> a;
+    for (int i = 0; i < 2000; i++) {
+        a.enqueue(i, (i * 31) % 977);
+    }
+    prqueue<int> b(a);
+    a.dequeue();
+    b.dequeue();
+
+    // Every reader finds the hashes stale and races to refresh them
+    vector<thread> readers;
+    atomic<int> equal{0};
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&] {
+            if (a == b && a.fingerprint() == b.fingerprint()) {
+                equal++;
+            }
+            prqueue<int> copy(a);
+            if (copy == b) {
+                equal++;
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(equal.load(), 8);
+}
+
+// Minimal in-process event loop for the async_prqueue tests.
+struct LocalScheduler {
+    deque<coroutine_handle<>> ready;
+
+    void post(coroutine_handle<> handle) {
+        ready.push_back(handle);
+    }
+
+    void run() {
+        while (!ready.empty()) {
+            coroutine_handle<> handle = ready.front();
+            ready.pop_front();
+            handle.resume();
+        }
+    }
+};
+
+// Fire-and-forget coroutine that starts eagerly and frees itself when done.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+Detached consume(async_prqueue<int>& queue, int count, vector<int>& out) {
+    for (int i = 0; i < count; i++) {
+        out.push_back(co_await queue.dequeue());
+    }
+}
+
+TEST(AsyncTest, ConsumerSuspendsUntilEnqueue) {
+    LocalScheduler loop;
+    async_prqueue<int> queue([&](coroutine_handle<> h) { loop.post(h); });
+    vector<int> out;
+
+    consume(queue, 3, out);
+    EXPECT_EQ(queue.waiting(), 1);
+    EXPECT_TRUE(out.empty());
+
+    // Both values arrive before the consumer runs, so it sees them in
+    // priority order
+    queue.enqueue(20, 2);
+    queue.enqueue(10, 1);
+    EXPECT_TRUE(out.empty());
+    loop.run();
+    EXPECT_EQ(out, vector<int>({10, 20}));
+    EXPECT_EQ(queue.waiting(), 1);
+
+    queue.enqueue(30, 3);
+    loop.run();
+    EXPECT_EQ(out, vector<int>({10, 20, 30}));
+    EXPECT_EQ(queue.size(), 0);
+}
+
+TEST(AsyncTest, EachEnqueueWakesOneConsumer) {
+    LocalScheduler loop;
+    async_prqueue<int> queue([&](coroutine_handle<> h) { loop.post(h); });
+    vector<int> first;
+    vector<int> second;
+
+    consume(queue, 1, first);
+    consume(queue, 1, second);
+    EXPECT_EQ(queue.waiting(), 2);
+
+    queue.enqueue(5, 5);
+    EXPECT_EQ(queue.waiting(), 1);
+
+    // The value is reserved for the scheduled consumer
+    int value;
+    EXPECT_FALSE(queue.try_dequeue(value));
+
+    queue.enqueue(1, 1);
+    loop.run();
+    EXPECT_EQ(first, vector<int>({1}));
+    EXPECT_EQ(second, vector<int>({5}));
+    EXPECT_EQ(queue.waiting(), 0);
+}
+
+TEST(AsyncTest, InlineExecutor) {
+    async_prqueue<int> queue;
+    vector<int> out;
+    queue.enqueue(7, 7);
+    consume(queue, 2, out);
+    EXPECT_EQ(out, vector<int>({7}));
+
+    queue.enqueue(8, 8);
+    EXPECT_EQ(out, vector<int>({7, 8}));
+}
+
+TEST(BatchTest, EnqueueBatchMatchesSortedEnqueues) {
+    prqueue<int> pq;
+    prqueue<int> expected;
+    int seed[] = {50, 20, 80, 20, 65};
+    for (int p : seed) {
+        pq.enqueue(p, p);
+        expected.enqueue(p, p);
+    }
+
+    vector<pair<int, int>> batch;
+    for (int i = 0; i < 40; i++) {
+        batch.push_back({1000 + i, (i * 37) % 100});
+    }
+    pq.enqueue_batch(batch);
+
+    stable_sort(batch.begin(), batch.end(), [](auto& a, auto& b) { return a.second < b.second; });
+    for (auto& item : batch) {
+        expected.enqueue(item.first, item.second);
+    }
+    EXPECT_EQ(pq.size(), expected.size());
+    EXPECT_EQ(pq.as_string(), expected.as_string());
+    EXPECT_EQ(pq.peek_max(), expected.peek_max());
+
+    // The incrementally maintained fingerprint matches a fresh copy
+    prqueue<int> copy(pq);
+    EXPECT_EQ(copy.fingerprint(), pq.fingerprint());
+    EXPECT_TRUE(copy == pq);
+}
+
+TEST(BatchTest, EnqueueBatchIntoEmptyIsBalanced) {
+    prqueue<int> pq;
+    vector<pair<int, int>> batch;
+    for (int i = 0; i < 7; i++) {
+        batch.push_back({i, i});
+    }
+    pq.enqueue_batch(batch);
+
+    prqueue<int> expected;
+    for (int p : {3, 1, 5, 0, 2, 4, 6}) {
+        expected.enqueue(p, p);
+    }
+    EXPECT_TRUE(pq == expected);
+}
+
+TEST(BatchTest, DequeueBatch) {
+    prqueue<int> pq;
+    prqueue<int> expected;
+    for (int i = 0; i < 30; i++) {
+        pq.enqueue(i, (i * 7) % 10);
+        expected.enqueue(i, (i * 7) % 10);
+    }
+
+    vector<int> out;
+    EXPECT_EQ(pq.dequeue_batch(12, out), 12);
+    for (int value : out) {
+        EXPECT_EQ(value, expected.dequeue());
+    }
+    EXPECT_EQ(pq.size(), 18);
+    EXPECT_EQ(pq.as_string(), expected.as_string());
+    prqueue<int> copy(pq);
+    EXPECT_EQ(copy.fingerprint(), pq.fingerprint());
+
+    out.clear();
+    EXPECT_EQ(pq.dequeue_batch(100, out), 18);
+    EXPECT_EQ(pq.size(), 0);
+    EXPECT_EQ(pq.getRoot(), nullptr);
+    EXPECT_EQ(pq.dequeue_batch(1, out), 0);
+}
+
+TEST(BlockingTest, ProducersAndConsumers) {
+    blocking_prqueue<int> queue(16);
+    const int perProducer = 500;
+
+    vector<thread> producers;
+    for (int t = 0; t < 2; t++) {
+        producers.emplace_back([&queue, t] {
+            for (int i = 0; i < perProducer; i += 10) {
+                vector<pair<int, int>> batch;
+                for (int j = i; j < i + 10; j++) {
+                    batch.push_back({t * perProducer + j, j});
+                }
+                queue.push_batch(batch);
+            }
+        });
+    }
+
+    long long sum = 0;
+    int received = 0;
+    thread consumer([&] {
+        vector<int> out;
+        while (received < 2 * perProducer) {
+            out.clear();
+            received += queue.pop_batch(7, out);
+            for (int value : out) {
+                sum += value;
+            }
+        }
+    });
+
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    consumer.join();
+    EXPECT_EQ(received, 2 * perProducer);
+    EXPECT_EQ(sum, (long long)(2 * perProducer) * (2 * perProducer - 1) / 2);
+    EXPECT_EQ(queue.size(), 0);
+}
+
+TEST(BlockingTest, PopOrderAndTimeout) {
+    blocking_prqueue<string> queue;
+    string value;
+    EXPECT_FALSE(queue.try_pop_for(value, chrono::milliseconds(10)));
+
+    queue.push("b", 2);
+    queue.push("a", 1);
+    EXPECT_TRUE(queue.try_pop_for(value, chrono::milliseconds(10)));
+    EXPECT_EQ(value, "a");
+
+    thread late([&] {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        queue.push("c", 0);
+    });
+    EXPECT_EQ(queue.pop(), "b");
+    EXPECT_EQ(queue.pop(), "c");
+    late.join();
+}
+
+TEST(SplitTest, DetachesUpperPriorities) {
+    prqueue<int> pq;
+    for (int i = 0; i < 20; i++) {
+        pq.enqueue(i, (i * 7) % 10);
+    }
+    prqueue<int> upper = pq.split(4);
+    EXPECT_EQ(pq.size(), 10);
+    EXPECT_EQ(upper.size(), 10);
+    EXPECT_EQ(pq.as_string(), "0 value: 0\n0 value: 10\n1 value: 3\n1 value: 13\n2 value: 6\n"
+                              "2 value: 16\n3 value: 9\n3 value: 19\n4 value: 2\n4 value: 12\n");
+    EXPECT_EQ(upper.peek(), 5);
+    EXPECT_EQ(upper.peek_max(), 17);
+    EXPECT_EQ(pq.peek_max(), 12);
+
+    prqueue<int> lowCopy(pq);
+    prqueue<int> upperCopy(upper);
+    EXPECT_TRUE(lowCopy == pq);
+    EXPECT_TRUE(upperCopy == upper);
+
+    prqueue<int> none = pq.split(100);
+    EXPECT_EQ(none.size(), 0);
+    EXPECT_EQ(pq.size(), 10);
+}
+
+TEST(WorkStealingTest, IdleWorkerStealsUpperHalf) {
+    work_stealing_prqueue<int> pool(3);
+    for (int i = 0; i < 10; i++) {
+        pool.enqueue(0, i, i);
+    }
+    pool.enqueue(1, 100, -5);
+
+    int priority;
+    EXPECT_TRUE(pool.approx_min(priority));
+    EXPECT_EQ(priority, -5);
+
+    int value;
+    EXPECT_TRUE(pool.dequeue(2, value));
+    EXPECT_EQ(value, 5);
+    EXPECT_EQ(pool.stats().steals, 1);
+    EXPECT_EQ(pool.stats().stolen, 5);
+    EXPECT_EQ(pool.size(), 10);
+
+    EXPECT_TRUE(pool.dequeue(0, value));
+    EXPECT_EQ(value, 0);
+}
+
+TEST(WorkStealingTest, SummariesFollowTheSmallestClass) {
+    work_stealing_prqueue<int> pool(2);
+    pool.enqueue(0, 1, 4);
+    pool.enqueue(0, 2, 2);
+    pool.enqueue(0, 3, 2);
+    pool.enqueue(0, 4, 7);
+
+    int priority;
+    ASSERT_TRUE(pool.approx_min(priority));
+    EXPECT_EQ(priority, 2);
+
+    int value;
+    EXPECT_TRUE(pool.dequeue(0, value));
+    ASSERT_TRUE(pool.approx_min(priority));
+    EXPECT_EQ(priority, 2);
+    EXPECT_TRUE(pool.dequeue(0, value));
+    ASSERT_TRUE(pool.approx_min(priority));
+    EXPECT_EQ(priority, 4);
+    EXPECT_EQ(pool.size(), 2);
+
+    // A single value can be stolen too
+    EXPECT_TRUE(pool.dequeue(0, value));
+    EXPECT_EQ(pool.steal(1), 1);
+    EXPECT_EQ(pool.size(), 1);
+    ASSERT_TRUE(pool.approx_min(priority));
+    EXPECT_EQ(priority, 7);
+    EXPECT_TRUE(pool.dequeue(1, value));
+    EXPECT_EQ(value, 4);
+    EXPECT_FALSE(pool.dequeue(0, value));
+    EXPECT_FALSE(pool.approx_min(priority));
+}
+
+TEST(WorkStealingTest, ConcurrentWorkersDrainEverything) {
+    const int workers = 4;
+    const int perWorker = 2000;
+    work_stealing_prqueue<int> pool(workers);
+
+    // Worker 0 gets all the work and stays idle, so the rest must steal
+    for (int i = 0; i < workers * perWorker; i++) {
+        pool.enqueue(0, 1, (i * 7919) % 1000);
+    }
+
+    atomic<int> done{0};
+    vector<thread> threads;
+    for (int w = 1; w < workers; w++) {
+        threads.emplace_back([&pool, &done, w] {
+            int value;
+            while (pool.dequeue(w, value)) {
+                done += value;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    // Only values no one could split off are left for their owners
+    int value;
+    for (int w = 0; w < workers; w++) {
+        while (pool.dequeue(w, value)) {
+            done += value;
+        }
+    }
+    EXPECT_EQ(done.load(), workers * perWorker);
+    EXPECT_EQ(pool.size(), 0);
+    EXPECT_GE(pool.stats().steals, 1);
+}
+
+TEST(ParallelTest, BuildMatchesSortedEnqueues) {
+    vector<pair<int, int>> items;
+    for (int i = 0; i < 20000; i++) {
+        items.push_back({i, (i * 7919) % 5003});
+    }
+
+    prqueue<int> pq;
+    pq.enqueue(-1, -1);
+    pq.build(items, 4);
+    EXPECT_EQ(pq.size(), items.size());
+
+    prqueue<int> sequential;
+    sequential.build(items, 1);
+    EXPECT_TRUE(pq == sequential);
+    EXPECT_EQ(pq.as_string(4), sequential.as_string());
+
+    vector<int> out;
+    pq.dequeue_batch(5, out);
+    EXPECT_EQ(out, vector<int>({0, 5003, 10006, 15009, 4140}));
+    EXPECT_EQ(pq.peek_max(), sequential.peek_max());
+
+    prqueue<int> copy(sequential);
+    EXPECT_EQ(copy.fingerprint(), sequential.fingerprint());
+}
+
+TEST(ParallelTest, BuildIsBalancedAndBounded) {
+    prqueue<int> pq(3);
+    pq.build({{5, 5}, {1, 1}, {3, 3}, {4, 4}, {2, 2}}, 2);
+
+    prqueue<int> expected;
+    expected.enqueue(2, 2);
+    expected.enqueue(1, 1);
+    expected.enqueue(3, 3);
+    EXPECT_TRUE(pq == expected);
+    EXPECT_FALSE(pq.enqueue(4, 4));
+}
+
+TEST(ParallelTest, ForEachVisitsEverything) {
+    prqueue<int> pq;
+    for (int i = 0; i < 5000; i++) {
+        pq.enqueue(i, (i * 31) % 977);
+    }
+
+    atomic<long long> sum{0};
+    pq.for_each([&sum](const int& value, int) { sum += value; }, 8);
+    EXPECT_EQ(sum.load(), 5000LL * 4999 / 2);
+
+    stringstream inOrder;
+    pq.for_each([&inOrder](const int& value, int priority) {
+        inOrder << priority << " value: " << value << endl;
+    });
+    EXPECT_EQ(inOrder.str(), pq.as_string());
+    EXPECT_EQ(pq.as_string(0), pq.as_string());
+}
+
+TEST(TraceTest, RecordsOperations) {
+    stringstream trace;
+    trace_recorder recorder(trace);
+
+    prqueue<int> pq;
+    pq.set_recorder(&recorder);
+    pq.enqueue(1, -70000);
+    pq.enqueue(2, 300);
+    pq.peek();
+    pq.dequeue();
+    pq.enqueue_batch({{3, 5}, {4, -1}});
+    vector<int> out;
+    pq.dequeue_batch(2, out);
+
+    // Copies do not record
+    prqueue<int> copy(pq);
+    copy.enqueue(5, 5);
+    pq.set_recorder(nullptr);
+    pq.dequeue();
+    EXPECT_EQ(recorder.size(), 8);
+
+    trace_reader reader(trace);
+    ASSERT_TRUE(reader.ok());
+    trace_op ops[] = {trace_op::enqueue, trace_op::enqueue, trace_op::peek, trace_op::dequeue,
+                      trace_op::enqueue, trace_op::enqueue, trace_op::dequeue, trace_op::dequeue};
+    int priorities[] = {-70000, 300, 0, 0, 5, -1, 0, 0};
+    trace_record record;
+    uint64_t last = 0;
+    for (int i = 0; i < 8; i++) {
+        ASSERT_TRUE(reader.next(record));
+        EXPECT_EQ(record.op, ops[i]);
+        EXPECT_EQ(record.priority, priorities[i]);
+        EXPECT_GE(record.timestamp, last);
+        last = record.timestamp;
+    }
+    EXPECT_FALSE(reader.next(record));
+}
+
+TEST(TraceTest, RecordsClassOperations) {
+    stringstream trace;
+    trace_recorder recorder(trace);
+
+    prqueue<int> pq;
+    for (int i = 0; i < 6; i++) {
+        pq.enqueue(i, i % 3);
+    }
+    pq.set_recorder(&recorder);
+    pq.dequeue_max();
+    pq.reprioritize_class(1, -200);
+    pq.extract_priority(-200);
+    prqueue<int> upper = pq.split(-5);
+    vector<int> out;
+    pq.apply_batch({{7, 4}}, 1, out);
+
+    // The returned queues do not record
+    upper.dequeue();
+    EXPECT_EQ(recorder.size(), 6);
+
+    trace_reader reader(trace);
+    ASSERT_TRUE(reader.ok());
+    trace_op ops[] = {trace_op::dequeue_max, trace_op::reprioritize_class, trace_op::extract_priority,
+                      trace_op::split, trace_op::enqueue, trace_op::dequeue};
+    int priorities[] = {0, 1, -200, -5, 4, 0};
+    int targets[] = {0, -200, 0, 0, 0, 0};
+    trace_record record;
+    for (int i = 0; i < 6; i++) {
+        ASSERT_TRUE(reader.next(record));
+        EXPECT_EQ(record.op, ops[i]);
+        EXPECT_EQ(record.priority, priorities[i]);
+        EXPECT_EQ(record.target, targets[i]);
+    }
+    EXPECT_FALSE(reader.next(record));
+}
+
+TEST(TraceTest, RecordsBulkOperations) {
+    stringstream trace;
+    trace_recorder recorder(trace);
+
+    prqueue<int> pq;
+    pq.set_recorder(&recorder);
+    pq.build({{1, 3}, {2, -1}, {3, 3}}, 2);
+    int value;
+    int priority;
+    pq.peek(value, priority);
+    pq.set_capacity(2);
+    pq.rebalance();
+    pq.clear();
+    pq.set_capacity(1ull << 40);
+
+    // Appends that rebalance automatically are not recorded as rebalances
+    pq.set_capacity(0);
+    for (int i = 0; i < 200; i++) {
+        pq.enqueue(i, i);
+    }
+    EXPECT_GT(pq.stats().rebalances, 1);
+    EXPECT_EQ(recorder.size(), 210);
+
+    trace_reader reader(trace);
+    ASSERT_TRUE(reader.ok());
+    trace_op ops[] = {trace_op::clear,        trace_op::enqueue,      trace_op::enqueue,
+                      trace_op::enqueue,      trace_op::peek,         trace_op::set_capacity,
+                      trace_op::rebalance,    trace_op::clear,        trace_op::set_capacity,
+                      trace_op::set_capacity};
+    int priorities[] = {0, -1, 3, 3, 0, 0, 0, 0, 0, 0};
+    uint64_t capacities[] = {0, 0, 0, 0, 0, 2, 0, 0, 1ull << 40, 0};
+    trace_record record;
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(reader.next(record));
+        EXPECT_EQ(record.op, ops[i]);
+        EXPECT_EQ(record.priority, priorities[i]);
+        EXPECT_EQ(record.capacity, capacities[i]);
+    }
+    for (int i = 0; i < 200; i++) {
+        ASSERT_TRUE(reader.next(record));
+        EXPECT_EQ(record.op, trace_op::enqueue);
+    }
+    EXPECT_FALSE(reader.next(record));
+}
+
+TEST(TraceTest, RejectsBadHeader) {
+    stringstream trace("nope");
+    trace_reader reader(trace);
+    trace_record record;
+    EXPECT_FALSE(reader.ok());
+    EXPECT_FALSE(reader.next(record));
+}
+
+TEST(HeightTest, CountsLongestPath) {
+    prqueue<int> pq;
+    EXPECT_EQ(pq.height(), 0);
+    pq.enqueue(1, 2);
+    pq.enqueue(1, 1);
+    pq.enqueue(1, 1);
+    pq.enqueue(1, 3);
+    pq.enqueue(1, 4);
+    EXPECT_EQ(pq.height(), 3);
+}
+
+TEST(CompactTest, MatchesPrqueue) {
+    compact_prqueue<int> compact;
+    prqueue<int> expected;
+    for (int i = 0; i < 300; i++) {
+        int priority = (i * 37) % 50;
+        EXPECT_TRUE(compact.enqueue(i, priority));
+        expected.enqueue(i, priority);
+        if (i % 4 == 3) {
+            EXPECT_EQ(compact.dequeue(), expected.dequeue());
+        }
+    }
+
+    EXPECT_EQ(compact.size(), expected.size());
+    EXPECT_EQ(compact.height(), expected.height());
+    EXPECT_EQ(compact.as_string(), expected.as_string());
+
+    int value;
+    int priority;
+    int count = 0;
+    compact.begin();
+    while (compact.next(value, priority)) {
+        count++;
+    }
+    EXPECT_EQ(count, compact.size());
+
+    while (expected.size() > 0) {
+        EXPECT_EQ(compact.peek(), expected.peek());
+        EXPECT_EQ(compact.dequeue(), expected.dequeue());
+    }
+    EXPECT_EQ(compact.size(), 0);
+    EXPECT_EQ(compact.dequeue(), 0);
+}
+
+TEST(CompactTest, ReusesFreedSlots) {
+    compact_prqueue<string> names;
+    names.enqueue("Jade", 3);
+    names.enqueue("Wade", 2);
+    names.enqueue("Sade", 2);
+    size_t bytes = names.memory_bytes();
+
+    EXPECT_EQ(names.dequeue(), "Wade");
+    EXPECT_EQ(names.dequeue(), "Sade");
+    names.enqueue("Zade", 1);
+    names.enqueue("Kade", 1);
+    EXPECT_EQ(names.memory_bytes(), bytes);
+    EXPECT_EQ(names.as_string(), "1 value: Zade\n1 value: Kade\n3 value: Jade\n");
+
+    compact_prqueue<string> copy(names);
+    names.clear();
+    EXPECT_EQ(copy.size(), 3);
+    EXPECT_EQ(names.as_string(), "");
+}
+
+TEST(ExportTest, ToVectorAndExportSorted) {
+    prqueue<string> names;
+    names.enqueue("Zack", 3);
+    names.enqueue("Mack", 2);
+    names.enqueue("Jack", 1);
+    names.enqueue("Isack", 2);
+    names.enqueue("Tack", 1);
+
+    vector<pair<string, int>> expected = {{"Jack", 1}, {"Tack", 1}, {"Mack", 2}, {"Isack", 2}, {"Zack", 3}};
+    EXPECT_EQ(names.to_vector(), expected);
+
+    vector<int> priorities;
+    vector<string> values;
+    names.export_sorted(priorities, values);
+    EXPECT_EQ(priorities, vector<int>({1, 1, 2, 2, 3}));
+    EXPECT_EQ(values, vector<string>({"Jack", "Tack", "Mack", "Isack", "Zack"}));
+    EXPECT_EQ(names.size(), 5);
+
+    prqueue<string> rebuilt;
+    rebuilt.build(names.to_vector());
+    EXPECT_EQ(rebuilt.as_string(), names.as_string());
+
+    EXPECT_EQ(std::move(names).to_vector(), expected);
+    EXPECT_EQ(names.size(), 0);
+    EXPECT_EQ(names.as_string(), "");
+}
+
+TEST(ExportTest, Freeze) {
+    prqueue<int> pq;
+    for (int i = 0; i < 10; i++) {
+        pq.enqueue(i, 9 - i);
+    }
+
+    prqueue<int>::frozen snapshot = pq.freeze();
+    pq.dequeue();
+    ASSERT_EQ(snapshot.size(), 10);
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        EXPECT_EQ(snapshot.priorities()[i], (int)i);
+        EXPECT_EQ(snapshot.values()[i], 9 - (int)i);
+    }
+
+    prqueue<int>::frozen moved = std::move(pq).freeze();
+    EXPECT_EQ(moved.size(), 9);
+    EXPECT_EQ(moved.values().front(), 8);
+    EXPECT_EQ(pq.size(), 0);
+}
+
+// Fills and drains a static_prqueue at compile time.
+constexpr int staticDrain() {
+    static_prqueue<int, 4> pq;
+    pq.enqueue(30, 3);
+    pq.enqueue(10, 1);
+    pq.enqueue(20, 2);
+    pq.enqueue(11, 1);
+    if (pq.enqueue(40, 4)) {
+        return -1;
+    }
+
+    int digits = 0;
+    while (pq.size() > 0) {
+        digits = digits * 100 + pq.dequeue();
+    }
+    return digits;
+}
+
+static_assert(staticDrain() == 10112030);
+
+TEST(StaticTest, ConstexprDrain) {
+    EXPECT_EQ(staticDrain(), 10112030);
+}
+
+TEST(StaticTest, MatchesPrqueue) {
+    static_prqueue<int, 64> fixed;
+    prqueue<int> expected;
+    for (int i = 0; i < 200; i++) {
+        int priority = (i * 13) % 17;
+        if (fixed.size() < fixed.capacity()) {
+            EXPECT_TRUE(fixed.enqueue(i, priority));
+            expected.enqueue(i, priority);
+        }
+        else {
+            EXPECT_FALSE(fixed.enqueue(i, priority));
+        }
+        if (i % 3 == 0) {
+            EXPECT_EQ(fixed.dequeue(), expected.dequeue());
+        }
+    }
+
+    EXPECT_EQ(fixed.size(), expected.size());
+    EXPECT_EQ(fixed.as_string(), expected.as_string());
+
+    int value;
+    int priority;
+    int last = INT_MIN;
+    size_t count = 0;
+    fixed.begin();
+    while (fixed.next(value, priority)) {
+        EXPECT_GE(priority, last);
+        last = priority;
+        count++;
+    }
+    EXPECT_EQ(count, fixed.size());
+
+    while (expected.size() > 0) {
+        EXPECT_EQ(fixed.peek(), expected.peek());
+        EXPECT_EQ(fixed.dequeue(), expected.dequeue());
+    }
+    EXPECT_EQ(fixed.dequeue(), 0);
+}
+
+TEST(FastPathTest, CountsAppends) {
+    prqueue<int> a;
+    a.enqueue(1, 10);
+    a.enqueue(2, 20);
+    a.enqueue(3, 30);
+    a.enqueue(4, 30);
+    a.enqueue(5, 15);
+    EXPECT_EQ(a.stats().fast_path, 3);
+    EXPECT_EQ(a.stats().descents, 1);
+    EXPECT_EQ(a.stats().rebalances, 0);
+
+    prqueue<int> b;
+    b.enqueue(1, 10);
+    b.enqueue_batch({{2, 20}, {5, 15}, {3, 30}, {4, 30}});
+    EXPECT_EQ(a.fingerprint(), b.fingerprint());
+    EXPECT_TRUE(a == b);
+    EXPECT_EQ(a.as_string(), "10 value: 1\n15 value: 5\n20 value: 2\n30 value: 3\n30 value: 4\n");
+}
+
+TEST(FastPathTest, KeepsChainTail) {
+    prqueue<string> pq;
+    pq.enqueue("a", 5);
+    pq.enqueue("b", 5);
+    EXPECT_EQ(pq.dequeue_max(), "b");
+    pq.enqueue("c", 5);
+    EXPECT_EQ(pq.as_string(), "5 value: a\n5 value: c\n");
+
+    pq.enqueue("d", 7);
+    pq.enqueue("e", 7);
+    EXPECT_EQ(pq.dequeue_max(), "e");
+    EXPECT_EQ(pq.dequeue_max(), "d");
+    pq.enqueue("f", 5);
+    EXPECT_EQ(pq.as_string(), "5 value: a\n5 value: c\n5 value: f\n");
+
+    // Evicting the tail moves it back one value
+    pq.set_capacity(2);
+    pq.enqueue("g", 5);
+    EXPECT_EQ(pq.as_string(), "5 value: a\n5 value: c\n");
+    pq.set_capacity(0);
+    pq.enqueue("h", 5);
+    EXPECT_EQ(pq.as_string(), "5 value: a\n5 value: c\n5 value: h\n");
+    EXPECT_EQ(pq.stats().descents, 0);
+}
+
+TEST(FastPathTest, RebalancesLazily) {
+    // The spine is rebalanced each time it grows as large as the rest of
+    // the tree, and the appends since the last time are left as a spine
+    prqueue<int> pq;
+    for (int i = 0; i < 1000; i++) {
+        pq.enqueue(i, i);
+    }
+    EXPECT_EQ(pq.height(), 482);
+    EXPECT_EQ(pq.stats().fast_path, 999);
+    EXPECT_EQ(pq.stats().descents, 0);
+    EXPECT_EQ(pq.stats().rebalances, 4);
+
+    size_t before = pq.fingerprint();
+    pq.enqueue(-1, -1);
+    EXPECT_EQ(pq.stats().rebalances, 4);
+    EXPECT_NE(pq.fingerprint(), before);
+    pq.rebalance();
+    EXPECT_EQ(pq.height(), 10);
+
+    prqueue<int> copy = pq;
+    EXPECT_TRUE(copy == pq);
+    EXPECT_EQ(pq.peek_max(), 999);
+    for (int i = -1; i < 1000; i++) {
+        EXPECT_EQ(pq.dequeue(), i);
+    }
+    EXPECT_EQ(pq.size(), 0);
+}
+
+TEST(FastPathTest, LongAppendRunStaysUsable) {
+    // Every walk of the tree keeps its own stack, so the spine left by the
+    // appends since the last rebalance cannot overflow the call stack
+    const int n = 1000000;
+    prqueue<int> pq;
+    for (int i = 0; i < n; i++) {
+        pq.enqueue(i, i);
+    }
+    EXPECT_GT(pq.stats().rebalances, 10);
+    EXPECT_LT(pq.height(), n);
+
+    prqueue<int> copy(pq);
+    EXPECT_EQ(copy.height(), pq.height());
+    EXPECT_TRUE(copy == pq);
+    EXPECT_EQ(copy.as_string().size(), pq.as_string().size());
+    size_t count = 0;
+    copy.for_each([&count](int, int) { count++; });
+    EXPECT_EQ(count, n);
+    prqueue<int> upper = copy.split(n / 2);
+    EXPECT_EQ(upper.size(), n - n / 2 - 1);
+    EXPECT_EQ(upper.peek(), n / 2 + 1);
+}
+
+TEST(FastPathTest, RebalanceThreshold) {
+    prqueue<int> pq;
+    for (int i = 0; i < 64; i++) {
+        pq.enqueue(i, i);
+    }
+
+    // 63 appended spine nodes are not enough
+    pq.enqueue(-1, -1);
+    EXPECT_EQ(pq.stats().rebalances, 0);
+
+    // 64 are, since they make up at least half of the 66 values
+    pq.enqueue(64, 64);
+    pq.enqueue(-2, -2);
+    EXPECT_EQ(pq.stats().rebalances, 1);
+    EXPECT_LE(pq.height(), 8);
+}
+
+TEST(FastPathTest, ReusedNodeIsRehashed) {
+    prqueue<int> pq(3);
+    pq.enqueue(5, 5);
+    pq.enqueue(1, 1);
+    pq.fingerprint();
+
+    // 9 is appended, then evicted, and its node reused for 3
+    pq.enqueue(9, 9);
+    pq.enqueue(3, 3);
+
+    prqueue<int> expected;
+    expected.enqueue(5, 5);
+    expected.enqueue(1, 1);
+    expected.enqueue(3, 3);
+    EXPECT_EQ(pq.fingerprint(), expected.fingerprint());
+    EXPECT_TRUE(pq == expected);
+}
+
+TEST(FastPathTest, LongSpine) {
+    prqueue<int> pq;
+    for (int i = 0; i < 100000; i++) {
+        pq.enqueue(i, i);
+    }
+    prqueue<int> other;
+    other.build(pq.to_vector());
+    EXPECT_NE(pq.fingerprint(), other.fingerprint());
+    pq.rebalance();
+    EXPECT_EQ(pq.fingerprint(), other.fingerprint());
+    EXPECT_TRUE(pq == other);
+
+    // Clearing the unbalanced spine must not recurse along it
+    prqueue<int> spine;
+    for (int i = 0; i < 100000; i++) {
+        spine.enqueue(i, i);
+    }
+    spine.clear();
+    EXPECT_EQ(spine.size(), 0);
+}
+
+TEST(MergedViewTest, GlobalOrder) {
+    vector<prqueue<int>> parts(7);
+    vector<pair<int, int>> expected;
+    for (int i = 0; i < 300; i++) {
+        int priority = (i * 31) % 53;
+        parts[i % 7].enqueue(i, priority);
+        expected.push_back({priority, i % 7});
+    }
+    // Equal priorities come from the earlier source first
+    sort(expected.begin(), expected.end());
+
+    vector<prqueue<int>*> sources;
+    for (auto& part : parts) {
+        sources.push_back(&part);
+    }
+    merged_view<int> view(sources);
+    EXPECT_EQ(view.sources(), 7);
+
+    int value;
+    int priority;
+    size_t count = 0;
+    while (view.next(value, priority)) {
+        ASSERT_LT(count, expected.size());
+        EXPECT_EQ(priority, expected[count].first);
+        EXPECT_EQ(value % 7, expected[count].second);
+        count++;
+    }
+    EXPECT_EQ(count, 300);
+    EXPECT_TRUE(view.empty());
+    for (auto& part : parts) {
+        EXPECT_EQ(part.size(), 0);
+    }
+}
+
+TEST(MergedViewTest, Refresh) {
+    prqueue<string> a;
+    prqueue<string> b;
+    prqueue<string> c;
+    a.enqueue("a5", 5);
+    c.enqueue("c3", 3);
+    merged_view<string> view({&a, &b, &c});
+
+    string value;
+    int priority;
+    EXPECT_TRUE(view.peek(value, priority));
+    EXPECT_EQ(value, "c3");
+
+    b.enqueue("b1", 1);
+    view.refresh(1);
+    EXPECT_TRUE(view.next(value, priority));
+    EXPECT_EQ(value, "b1");
+    EXPECT_EQ(priority, 1);
+
+    c.dequeue();
+    view.refresh(2);
+    EXPECT_TRUE(view.next(value, priority));
+    EXPECT_EQ(value, "a5");
+    EXPECT_FALSE(view.next(value, priority));
+
+    merged_view<string> none({});
+    EXPECT_TRUE(none.empty());
+    EXPECT_FALSE(none.peek(value, priority));
+}
+
+TEST(PeekNTest, SmallestWithoutChanges) {
+    prqueue<int> pq;
+    for (int i = 0; i < 40; i++) {
+        pq.enqueue(i, (i * 7) % 11);
+    }
+    string before = pq.as_string();
+    vector<pair<int, int>> all = pq.to_vector();
+
+    vector<pair<int, int>> top;
+    EXPECT_EQ(pq.peek_n(10, top), 10);
+    EXPECT_EQ(top, (vector<pair<int, int>>(all.begin(), all.begin() + 10)));
+    EXPECT_EQ(pq.as_string(), before);
+
+    top.clear();
+    EXPECT_EQ(pq.peek_n(100, top), 40);
+    EXPECT_EQ(top, all);
+
+    prqueue<int> empty;
+    EXPECT_EQ(empty.peek_n(5, top), 0);
+}
+
+TEST(PeekNTest, ViewLeavesCursorAlone) {
+    prqueue<string> pq;
+    pq.enqueue("b", 2);
+    pq.enqueue("a", 1);
+    pq.enqueue("c", 2);
+    pq.enqueue("d", 3);
+
+    string value;
+    int priority;
+    pq.begin();
+    EXPECT_TRUE(pq.next(value, priority));
+    EXPECT_EQ(value, "a");
+
+    auto view = pq.peek_view();
+    string seen;
+    while (view.next(value, priority)) {
+        seen += value;
+    }
+    EXPECT_EQ(seen, "abcd");
+    EXPECT_FALSE(view.next(value, priority));
+
+    EXPECT_TRUE(pq.next(value, priority));
+    EXPECT_EQ(value, "b");
+    EXPECT_TRUE(pq.next(value, priority));
+    EXPECT_EQ(value, "c");
+}
+
+TEST(ApplyBatchTest, MatchesPerOpCalls) {
+    prqueue<int> batched;
+    prqueue<int> single;
+    int next = 0;
+    for (int tick = 0; tick < 20; tick++) {
+        vector<pair<int, int>> items;
+        for (int i = 0; i < 30; i++) {
+            items.push_back({next, (next * 17) % 23});
+            next++;
+        }
+        size_t dequeues = (tick * 7) % 40;
+
+        vector<int> expected;
+        for (auto& item : items) {
+            single.enqueue(item.first, item.second);
+        }
+        for (size_t i = 0; i < dequeues && single.size() > 0; i++) {
+            expected.push_back(single.dequeue());
+        }
+
+        vector<int> out;
+        EXPECT_EQ(batched.apply_batch(items, dequeues, out), expected.size());
+        EXPECT_EQ(out, expected);
+        EXPECT_EQ(batched.size(), single.size());
+        EXPECT_EQ(batched.as_string(), single.as_string());
+    }
+}
+
+TEST(ApplyBatchTest, DequeuesMoreThanHeld) {
+    prqueue<string> pq;
+    pq.enqueue("old", 2);
+    vector<string> out;
+    EXPECT_EQ(pq.apply_batch({{"new", 2}, {"first", 1}}, 5, out), 3);
+    EXPECT_EQ(out, (vector<string>{"first", "old", "new"}));
+    EXPECT_EQ(pq.size(), 0);
+
+    prqueue<string> bounded(1);
+    out.clear();
+    EXPECT_EQ(bounded.apply_batch({{"b", 2}, {"a", 1}}, 0, out), 0);
+    EXPECT_EQ(bounded.as_string(), "1 value: a\n");
+}
+
+// A fresh directory under the system temp directory, removed afterwards.
+struct TempDir {
+    filesystem::path path;
+
+    TempDir() {
+        path = filesystem::temp_directory_path() / ("prqueue-test-" + to_string(getpid()));
+        filesystem::remove_all(path);
+        filesystem::create_directories(path);
+    }
+
+    ~TempDir() {
+        filesystem::remove_all(path);
+    }
+
+    size_t files() const {
+        return distance(filesystem::directory_iterator(path), filesystem::directory_iterator());
+    }
+};
+
+TEST(ExternalTest, SpillsAndMerges) {
+    TempDir dir;
+    {
+        external_prqueue<int> pq(dir.path.string(), 8);
+        vector<int> expected;
+        for (int i = 0; i < 2000; i++) {
+            int priority = (i * 7919) % 1009;
+            EXPECT_TRUE(pq.enqueue(i, priority));
+            expected.push_back(priority);
+            EXPECT_LE(pq.in_memory(), 8);
+        }
+        EXPECT_EQ(pq.size(), 2000);
+        EXPECT_GT(pq.run_count(), 0);
+        EXPECT_LE(pq.run_count(), 3 * 15);
+        EXPECT_EQ(dir.files(), pq.run_count());
+
+        sort(expected.begin(), expected.end());
+        int value;
+        int priority;
+        for (int want : expected) {
+            ASSERT_TRUE(pq.peek(value, priority));
+            EXPECT_EQ(priority, want);
+            EXPECT_EQ((value * 7919) % 1009, want);
+            EXPECT_EQ(pq.dequeue(), value);
+        }
+        EXPECT_EQ(pq.size(), 0);
+        EXPECT_EQ(pq.run_count(), 0);
+        EXPECT_EQ(dir.files(), 0);
+    }
+}
+
+TEST(ExternalTest, MergesInLevels) {
+    TempDir dir;
+    external_prqueue<int> pq(dir.path.string(), 8);
+    for (int i = 0; i < 20000; i++) {
+        EXPECT_TRUE(pq.enqueue(i, (i * 7919) % 10007));
+        // About 5000 spills of 4 values leave at most 15 runs on each of
+        // 4 levels
+        ASSERT_LE(pq.run_count(), 4 * 15);
+    }
+    EXPECT_EQ(dir.files(), pq.run_count());
+    int last = INT_MIN;
+    int value;
+    int priority;
+    while (pq.peek(value, priority)) {
+        EXPECT_GE(priority, last);
+        last = priority;
+        pq.dequeue();
+    }
+    EXPECT_EQ(pq.lost(), 0);
+    EXPECT_EQ(dir.files(), 0);
+}
+
+TEST(ExternalTest, UnreadableRunIsCountedAsLost) {
+    TempDir dir;
+    external_prqueue<int> pq(dir.path.string(), 64);
+    for (int i = 0; i < 10000; i++) {
+        pq.enqueue(i, i);
+    }
+    ASSERT_GT(pq.run_count(), 1);
+
+    // Cut the largest run, well past what its stream has buffered, down to
+    // the head already read
+    filesystem::path largest;
+    for (auto& entry : filesystem::directory_iterator(dir.path)) {
+        if (largest.empty() || entry.file_size() > filesystem::file_size(largest)) {
+            largest = entry.path();
+        }
+    }
+    ASSERT_GT(filesystem::file_size(largest), 16 * 1024);
+    filesystem::resize_file(largest, sizeof(int) * 2);
+
+    size_t taken = 0;
+    while (pq.size() > 0 && taken < 10000) {
+        pq.dequeue();
+        taken++;
+    }
+    EXPECT_EQ(pq.size(), 0);
+    EXPECT_GT(pq.lost(), 0);
+    EXPECT_EQ(taken + pq.lost(), 10000);
+    EXPECT_EQ(dir.files(), 0);
+}
+
+TEST(ExternalTest, InterleavedMatchesPrqueue) {
+    TempDir dir;
+    external_prqueue<long long> pq(dir.path.string(), 32);
+    prqueue<long long> expected;
+    for (int i = 0; i < 3000; i++) {
+        int priority = (i * 37) % 211 - 100;
+        pq.enqueue(i, priority);
+        expected.enqueue(i, priority);
+        if (i % 3 == 0) {
+            long long value;
+            int want;
+            expected.peek(value, want);
+            expected.dequeue();
+            int got;
+            ASSERT_TRUE(pq.peek(value, got));
+            EXPECT_EQ(got, want);
+            pq.dequeue();
+        }
+    }
+    EXPECT_EQ(pq.size(), expected.size());
+    EXPECT_GT(dir.files(), 0);
+    pq.clear();
+    EXPECT_EQ(dir.files(), 0);
+}
+
+TEST(ExternalTest, DequeueStaysWithinBudget) {
+    TempDir dir;
+    external_prqueue<int> pq(dir.path.string(), 4);
+    for (int i = 1; i <= 5; i++) {
+        pq.enqueue(i, i);
+    }
+    EXPECT_EQ(pq.dequeue(), 1);
+    EXPECT_EQ(pq.dequeue(), 2);
+    EXPECT_EQ(pq.dequeue(), 3);
+
+    // Fill the buffer while a smaller value is still on disk
+    for (int i = 10; i <= 12; i++) {
+        pq.enqueue(i, i);
+    }
+    ASSERT_EQ(pq.in_memory(), pq.budget());
+    ASSERT_GT(pq.run_count(), 0);
+    for (int want : {4, 5, 10, 11, 12}) {
+        EXPECT_EQ(pq.dequeue(), want);
+        EXPECT_LE(pq.in_memory(), pq.budget());
+    }
+    EXPECT_EQ(pq.size(), 0);
+}
+
+TEST(ExternalTest, QueuesShareADirectory) {
+    TempDir dir;
+    vector<unique_ptr<external_prqueue<int>>> queues;
+    for (int q = 0; q < 3; q++) {
+        queues.emplace_back(new external_prqueue<int>(dir.path.string(), 4));
+    }
+    for (int i = 0; i < 300; i++) {
+        for (int q = 0; q < 3; q++) {
+            EXPECT_TRUE(queues[q]->enqueue(q * 1000 + i, 300 - i));
+        }
+    }
+    size_t runs = 0;
+    for (auto& pq : queues) {
+        runs += pq->run_count();
+    }
+    EXPECT_EQ(dir.files(), runs);
+
+    // Each queue reads back only its own values
+    for (int q = 0; q < 3; q++) {
+        for (int i = 299; i >= 0; i--) {
+            EXPECT_EQ(queues[q]->dequeue(), q * 1000 + i);
+        }
+    }
+    EXPECT_EQ(dir.files(), 0);
+}
+
+struct Job {
+    int id;
+    string name;
+};
+
+TEST(IndexTest, FollowsOperations) {
+    prqueue<Job, int> pq;
+    pq.enqueue({1, "early"}, 5);
+    pq.index_by([](const Job& job) { return job.id; });
+    EXPECT_TRUE(pq.contains(1));
+
+    EXPECT_TRUE(pq.enqueue_if_absent({2, "a"}, 3));
+    EXPECT_TRUE(pq.enqueue_if_absent({3, "b"}, 3));
+    EXPECT_FALSE(pq.enqueue_if_absent({2, "again"}, 1));
+    EXPECT_TRUE(pq.enqueue_if_absent({4, "c"}, 3));
+    EXPECT_EQ(pq.size(), 4);
+
+    Job job;
+    int priority;
+    ASSERT_TRUE(pq.find(3, job, priority));
+    EXPECT_EQ(job.name, "b");
+    EXPECT_EQ(priority, 3);
+
+    // Dequeuing 2 moves 3 into the head of the chain
+    EXPECT_EQ(pq.dequeue().id, 2);
+    EXPECT_FALSE(pq.contains(2));
+    ASSERT_TRUE(pq.find(3, job, priority));
+    EXPECT_EQ(job.name, "b");
+    EXPECT_EQ(pq.dequeue().id, 3);
+    ASSERT_TRUE(pq.find(4, job, priority));
+    EXPECT_EQ(job.name, "c");
+
+    EXPECT_EQ(pq.dequeue_max().id, 1);
+    EXPECT_FALSE(pq.contains(1));
+    EXPECT_TRUE(pq.contains(4));
+
+    pq.enqueue_batch({{{5, "d"}, 4}, {{6, "e"}, 9}, {{7, "f"}, 9}});
+    prqueue<Job, int> upper = pq.split(4);
+    EXPECT_TRUE(pq.contains(5));
+    EXPECT_FALSE(pq.contains(6));
+    EXPECT_TRUE(upper.contains(6));
+    EXPECT_TRUE(upper.contains(7));
+
+    prqueue<Job, int> copy = pq;
+    pq.clear();
+    EXPECT_FALSE(pq.contains(4));
+    EXPECT_TRUE(copy.contains(4));
+    EXPECT_TRUE(copy.contains(5));
+
+    vector<Job> out;
+    copy.dequeue_batch(2, out);
+    EXPECT_FALSE(copy.contains(4));
+    EXPECT_FALSE(copy.contains(5));
+}
+
+TEST(IndexTest, BoundedEviction) {
+    prqueue<int, int> pq(2);
+    pq.index_by([](const int& value) { return value / 10; });
+    pq.enqueue(10, 1);
+    pq.enqueue(20, 2);
+    pq.enqueue(21, 2);
+    EXPECT_TRUE(pq.contains(1));
+    EXPECT_TRUE(pq.contains(2));
+    pq.enqueue(30, 0);
+    EXPECT_FALSE(pq.contains(2));
+    EXPECT_TRUE(pq.contains(3));
+
+    int value;
+    int priority;
+    pq.build({{40, 7}, {50, 8}});
+    EXPECT_FALSE(pq.contains(3));
+    ASSERT_TRUE(pq.find(5, value, priority));
+    EXPECT_EQ(value, 50);
+    EXPECT_EQ(priority, 8);
+}
+
+TEST(ClassTest, ExtractPriority) {
+    prqueue<string> pq;
+    for (int priority : {5, 2, 8, 1, 3, 7, 9, 6}) {
+        pq.enqueue("v" + to_string(priority), priority);
+    }
+    pq.enqueue("w5", 5);
+    pq.enqueue("x5", 5);
+    EXPECT_EQ(pq.count_priority(5), 3);
+    EXPECT_EQ(pq.count_priority(4), 0);
+
+    // 5 is the root and has two children
+    prqueue<string> five = pq.extract_priority(5);
+    EXPECT_EQ(five.size(), 3);
+    EXPECT_EQ(five.as_string(), "5 value: v5\n5 value: w5\n5 value: x5\n");
+    EXPECT_EQ(pq.size(), 7);
+    EXPECT_EQ(pq.count_priority(5), 0);
+    EXPECT_EQ(pq.as_string(), "1 value: v1\n2 value: v2\n3 value: v3\n6 value: v6\n7 value: v7\n8 value: v8\n9 value: v9\n");
+
+    prqueue<string> expected;
+    expected.enqueue("v5", 5);
+    expected.enqueue("w5", 5);
+    expected.enqueue("x5", 5);
+    EXPECT_TRUE(five == expected);
+    EXPECT_EQ(five.dequeue_max(), "x5");
+
+    // Leaves and the largest class, then a missing one
+    EXPECT_EQ(pq.extract_priority(9).size(), 1);
+    EXPECT_EQ(pq.peek_max(), "v8");
+    EXPECT_EQ(pq.extract_priority(1).size(), 1);
+    EXPECT_EQ(pq.extract_priority(4).size(), 0);
+    EXPECT_EQ(pq.size(), 5);
+
+    // The tree still iterates and drains in order
+    pq.begin();
+    string value;
+    int priority;
+    size_t count = 0;
+    while (pq.next(value, priority)) {
+        count++;
+    }
+    EXPECT_EQ(count, 5);
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(pq.dequeue().substr(0, 1), "v");
+    }
+    EXPECT_EQ(pq.size(), 0);
+}
+
+TEST(ClassTest, ExtractKeepsFingerprint) {
+    prqueue<int> a;
+    prqueue<int> b;
+    for (int priority : {50, 30, 70, 20, 40, 60, 80, 35, 45}) {
+        a.enqueue(priority, priority);
+        if (priority != 30) {
+            b.enqueue(priority, priority);
+        }
+    }
+    a.fingerprint();
+    a.extract_priority(30);
+    // 30's successor 35 takes its place
+    prqueue<int> c;
+    for (int priority : {50, 35, 70, 20, 40, 60, 80, 45}) {
+        c.enqueue(priority, priority);
+    }
+    EXPECT_TRUE(a == c);
+    EXPECT_EQ(a.fingerprint(), c.fingerprint());
+    EXPECT_EQ(a.as_string(), b.as_string());
+}
+
+TEST(ClassTest, Reprioritize) {
+    prqueue<string, string> pq;
+    pq.index_by([](const string& value) { return value; });
+    pq.enqueue("a", 3);
+    pq.enqueue("b", 3);
+    pq.enqueue("c", 1);
+    pq.enqueue("d", 5);
+    pq.enqueue("e", 4);
+
+    // Onto an existing class, after its values
+    EXPECT_EQ(pq.reprioritize_class(3, 5), 2);
+    EXPECT_EQ(pq.count_priority(5), 3);
+    EXPECT_EQ(pq.count_priority(3), 0);
+    EXPECT_EQ(pq.as_string(), "1 value: c\n4 value: e\n5 value: d\n5 value: a\n5 value: b\n");
+    string value;
+    int priority;
+    ASSERT_TRUE(pq.find("b", value, priority));
+    EXPECT_EQ(priority, 5);
+
+    // To a new priority, at both ends
+    EXPECT_EQ(pq.reprioritize_class(5, 0), 3);
+    EXPECT_EQ(pq.as_string(), "0 value: d\n0 value: a\n0 value: b\n1 value: c\n4 value: e\n");
+    EXPECT_EQ(pq.reprioritize_class(1, 9), 1);
+    EXPECT_EQ(pq.peek_max(), "c");
+    EXPECT_EQ(pq.reprioritize_class(2, 3), 0);
+    EXPECT_EQ(pq.size(), 5);
+
+    pq.enqueue("f", 9);
+    EXPECT_EQ(pq.dequeue_max(), "f");
+    EXPECT_EQ(pq.dequeue_max(), "c");
+    EXPECT_EQ(pq.dequeue(), "d");
+    EXPECT_EQ(pq.dequeue(), "a");
+    EXPECT_TRUE(pq.contains("b"));
+    EXPECT_EQ(pq.dequeue(), "b");
+    EXPECT_FALSE(pq.contains("b"));
+    EXPECT_EQ(pq.dequeue(), "e");
+    EXPECT_EQ(pq.size(), 0);
+}
+
+TEST(ShmTest, ForkedProducers) {
+    string name = "/prqueue-test-" + to_string(getpid());
+    shm_prqueue<long long>::remove(name);
+    shm_prqueue<long long> pq(name, 4096);
+    ASSERT_TRUE(pq.ok());
+    EXPECT_FALSE(shm_prqueue<long long>(name, 16).ok());
+    EXPECT_FALSE(shm_prqueue<int>(name).ok());
+
+    const int producers = 4;
+    const int each = 500;
+    vector<pid_t> children;
+    for (int p = 0; p < producers; p++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Attach by name, as an unrelated process would
+            shm_prqueue<long long> child(name);
+            bool good = child.ok();
+            for (int i = 0; i < each && good; i++) {
+                good = child.enqueue(p * each + i, (i * 31 + p) % 97);
+            }
+            _exit(good ? 0 : 1);
+        }
+        ASSERT_GT(pid, 0);
+        children.push_back(pid);
+    }
+
+    // Consume while the producers run
+    vector<bool> seen(producers * each, false);
+    int received = 0;
+    while (received < producers * each / 2) {
+        long long value;
+        int priority;
+        if (pq.dequeue(value, priority)) {
+            ASSERT_FALSE(seen[value]);
+            seen[value] = true;
+            EXPECT_EQ(priority, ((value % each) * 31 + value / each) % 97);
+            received++;
+        }
+        else {
+            this_thread::yield();
+        }
+    }
+    for (pid_t pid : children) {
+        int status;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    // The rest come out in priority order
+    EXPECT_EQ(pq.size(), producers * each - received);
+    int last = INT_MIN;
+    while (pq.consume([&](const long long& value, int priority) {
+        EXPECT_FALSE(seen[value]);
+        seen[value] = true;
+        EXPECT_GE(priority, last);
+        last = priority;
+    })) {
+        received++;
+    }
+    EXPECT_EQ(received, producers * each);
+    EXPECT_EQ(pq.size(), 0);
+    EXPECT_TRUE(shm_prqueue<long long>::remove(name));
+}
+
+TEST(ShmTest, MatchesPrqueue) {
+    string name = "/prqueue-test-match-" + to_string(getpid());
+    shm_prqueue<int>::remove(name);
+    shm_prqueue<int> shared(name, 8);
+    ASSERT_TRUE(shared.ok());
+    prqueue<int> expected;
+    for (int i = 0; i < 40; i++) {
+        int priority = (i * 5) % 7;
+        if (shared.size() < shared.capacity()) {
+            EXPECT_TRUE(shared.enqueue(i, priority));
+            expected.enqueue(i, priority);
+        }
+        else {
+            EXPECT_FALSE(shared.enqueue(i, priority));
+        }
+        if (i % 2 == 0) {
+            int value;
+            int p;
+            ASSERT_TRUE(shared.dequeue(value, p));
+            EXPECT_EQ(value, expected.dequeue());
+        }
+    }
+    EXPECT_EQ(shared.size(), expected.size());
+    shm_prqueue<int>::remove(name);
+}
+
+TEST(ShmTest, ThrowingConsumerReleasesTheLock) {
+    string name = "/prqueue-test-throw-" + to_string(getpid());
+    shm_prqueue<int>::remove(name);
+    shm_prqueue<int> shared(name, 4);
+    ASSERT_TRUE(shared.ok());
+    shared.enqueue(7, 1);
+
+    EXPECT_THROW(shared.consume([](const int&, int) { throw runtime_error("consumer failed"); }), runtime_error);
+    EXPECT_FALSE(shared.broken());
+    int value;
+    int priority;
+    ASSERT_TRUE(shared.dequeue(value, priority));
+    EXPECT_EQ(value, 7);
+    shm_prqueue<int>::remove(name);
+}
+
+TEST(ShmTest, UnmappedQueueFailsSafely) {
+    shm_prqueue<int> missing("/prqueue-test-missing-" + to_string(getpid()));
+    ASSERT_FALSE(missing.ok());
+    EXPECT_FALSE(missing.broken());
+    EXPECT_EQ(missing.size(), 0);
+    EXPECT_EQ(missing.capacity(), 0);
+    EXPECT_FALSE(missing.enqueue(1, 1));
+    int value;
+    int priority;
+    EXPECT_FALSE(missing.peek(value, priority));
+    EXPECT_FALSE(missing.dequeue(value, priority));
+}
+
+TEST(ShmTest, RejectsTruncatedSegments) {
+    string name = "/prqueue-test-short-" + to_string(getpid());
+    shm_prqueue<int>::remove(name);
+    {
+        shm_prqueue<int> pq(name, 1024);
+        ASSERT_TRUE(pq.ok());
+    }
+
+    // Shorter than the nodes the header promises
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ftruncate(fd, 4096), 0);
+    EXPECT_FALSE(shm_prqueue<int>(name).ok());
+
+    // Shorter than the header itself
+    ASSERT_EQ(ftruncate(fd, 8), 0);
+    EXPECT_FALSE(shm_prqueue<int>(name).ok());
+    close(fd);
+    shm_prqueue<int>::remove(name);
+}
+
+TEST(ShmTest, OwnerDeathBreaksTheSegment) {
+    string name = "/prqueue-test-dead-" + to_string(getpid());
+    shm_prqueue<int>::remove(name);
+    shm_prqueue<int> pq(name, 4);
+    ASSERT_TRUE(pq.ok());
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(pq.enqueue(i, i));
+    }
+    EXPECT_FALSE(pq.enqueue(4, 4));
+    EXPECT_FALSE(pq.broken());
+
+    // The child dies while `consume` holds the lock
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_prqueue<int> child(name);
+        child.consume([](const int&, int) { _exit(0); });
+        _exit(1);
+    }
+    ASSERT_GT(pid, 0);
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    int value;
+    int priority;
+    EXPECT_FALSE(pq.dequeue(value, priority));
+    EXPECT_TRUE(pq.broken());
+    EXPECT_FALSE(pq.enqueue(4, 4));
+    EXPECT_FALSE(pq.peek(value, priority));
+    shm_prqueue<int>::remove(name);
+}
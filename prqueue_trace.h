@@ -0,0 +1,188 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+/// Operations captured in a `prqueue` trace.
+enum class trace_op : uint8_t {
+    enqueue = 0,
+    dequeue = 1,
+    peek = 2,
+    dequeue_max = 3,
+    extract_priority = 4,
+    reprioritize_class = 5,
+    split = 6,
+    set_capacity = 7,
+    clear = 8,
+    rebalance = 9,
+};
+
+// Returns true if records of `op` carry a priority.
+inline bool traceHasPriority(trace_op op) {
+    return op == trace_op::enqueue || op == trace_op::extract_priority || op == trace_op::reprioritize_class ||
+           op == trace_op::split;
+}
+
+/// One operation read back from a trace.
+struct trace_record {
+    trace_op op;
+    int priority;        // Only meaningful for operations that take one
+    int target;          // Only meaningful for `trace_op::reprioritize_class`
+    uint64_t capacity;   // Only meaningful for `trace_op::set_capacity`
+    uint64_t timestamp;  // Nanoseconds since the recorder was created
+};
+
+/// Writes `prqueue` operations to a compact binary trace.
+///
+/// A trace starts with the 4-byte magic "PQT1". Each record is one byte
+/// holding the operation, then the nanoseconds since the previous record
+/// as a base-128 varint, then for operations that take a priority, the
+/// priority as a zigzag-encoded varint. `reprioritize_class` records add the
+/// new priority the same way, and `set_capacity` records hold the capacity
+/// as a varint. Typical records take 3 to 6 bytes.
+///
+/// Attach a recorder with `prqueue::set_recorder`. It is not thread-safe.
+class trace_recorder {
+   private:
+    ostream& out;
+    chrono::steady_clock::time_point start;
+    uint64_t last;
+    size_t count;
+
+    void writeZigzag(int value) {
+        uint32_t bits = static_cast<uint32_t>(value);
+        writeVarint((bits << 1) ^ static_cast<uint32_t>(value >> 31));
+    }
+
+    void writeVarint(uint64_t value) {
+        while (value >= 0x80) {
+            out.put(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.put(static_cast<char>(value));
+    }
+
+    // Appends one record; each argument is written only for the operations
+    // that take it.
+    void recordArguments(trace_op op, int priority, int target, uint64_t capacity) {
+        uint64_t now = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        out.put(static_cast<char>(op));
+        writeVarint(now - last);
+        if (traceHasPriority(op)) {
+            writeZigzag(priority);
+        }
+        if (op == trace_op::reprioritize_class) {
+            writeZigzag(target);
+        }
+        if (op == trace_op::set_capacity) {
+            writeVarint(capacity);
+        }
+        last = now;
+        count++;
+    }
+
+   public:
+    /// Starts a trace on `output`, which must outlive the recorder.
+    explicit trace_recorder(ostream& output) : out(output) {
+        start = chrono::steady_clock::now();
+        last = 0;
+        count = 0;
+        out.write("PQT1", 4);
+    }
+
+    /// Appends one operation, timestamped now. `target` is only written for
+    /// `trace_op::reprioritize_class`.
+    void record(trace_op op, int priority = 0, int target = 0) {
+        recordArguments(op, priority, target, 0);
+    }
+
+    /// Appends a `trace_op::set_capacity` record, timestamped now.
+    void record_capacity(uint64_t capacity) {
+        recordArguments(trace_op::set_capacity, 0, 0, capacity);
+    }
+
+    /// Returns the number of operations recorded.
+    size_t size() const {
+        return count;
+    }
+};
+
+/// Reads back a trace written by `trace_recorder`.
+class trace_reader {
+   private:
+    istream& in;
+    uint64_t last;
+    bool valid;
+
+    bool readZigzag(int& value) {
+        uint64_t zigzag;
+        if (!readVarint(zigzag)) {
+            return false;
+        }
+        uint32_t bits = static_cast<uint32_t>(zigzag);
+        value = static_cast<int>((bits >> 1) ^ (~(bits & 1) + 1));
+        return true;
+    }
+
+    bool readVarint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = in.get();
+            if (byte == EOF) {
+                return false;
+            }
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+   public:
+    /// Starts reading the trace on `input`. Check `ok` for a valid header.
+    explicit trace_reader(istream& input) : in(input) {
+        last = 0;
+        char magic[4];
+        valid = static_cast<bool>(in.read(magic, 4)) && string(magic, 4) == "PQT1";
+    }
+
+    /// Returns true if the trace had a valid header.
+    bool ok() const {
+        return valid;
+    }
+
+    /// Reads the next record into `record`. Returns false at the end of the
+    /// trace, or if it is truncated or corrupt.
+    bool next(trace_record& record) {
+        int op = valid ? in.get() : EOF;
+        if (op == EOF || op > static_cast<int>(trace_op::rebalance)) {
+            return false;
+        }
+
+        uint64_t delta;
+        if (!readVarint(delta)) {
+            return false;
+        }
+        record.op = static_cast<trace_op>(op);
+        record.timestamp = last += delta;
+        record.priority = 0;
+        record.target = 0;
+        record.capacity = 0;
+
+        if (traceHasPriority(record.op) && !readZigzag(record.priority)) {
+            return false;
+        }
+        if (record.op == trace_op::reprioritize_class && !readZigzag(record.target)) {
+            return false;
+        }
+        if (record.op == trace_op::set_capacity && !readVarint(record.capacity)) {
+            return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,419 @@
+#pragma once
+
+#include <cerrno>       // For EOWNERDEAD
+#include <cstdint>
+#include <fcntl.h>      // For O_CREAT
+#include <pthread.h>
+#include <string>
+#include <sys/mman.h>   // For shm_open and mmap
+#include <sys/stat.h>   // For fstat
+#include <type_traits>  // For is_trivially_copyable_v
+#include <unistd.h>     // For ftruncate
+
+using namespace std;
+
+/// A `prqueue` that lives in a named POSIX shared-memory segment, so that
+/// several processes can enqueue into it and dequeue from it directly.
+///
+/// The segment holds a header and a fixed array of `capacity` nodes, which
+/// link to each other by 32-bit indices into the array instead of pointers,
+/// so every process can map it at a different address. Values are written
+/// straight into their node by `enqueue`, and `consume` reads them in
+/// place, so nothing is serialized. `T` must be trivially copyable.
+///
+/// Every operation holds a process-shared mutex in the segment. The mutex
+/// is robust: if a process dies while holding it, the next process to lock
+/// it finds out instead of waiting forever. Since the operation that was
+/// cut short may have left the tree inconsistent, the segment is then marked
+/// broken, and every later operation on it fails; see `broken`.
+///
+/// Construction reports failure through `ok` rather than an exception.
+/// Unlike `prqueue`, the tree is never rebalanced.
+template <typename T>
+class shm_prqueue {
+    static_assert(is_trivially_copyable_v<T>, "values are shared byte for byte between processes");
+
+   private:
+    static const uint32_t NIL = UINT32_MAX;
+    static const uint32_t MAGIC = 0x50515348;  // "PQSH"
+
+    struct alignas(64) HEADER {
+        uint32_t magic;
+        uint32_t valueSize;  // sizeof(T) in the creating process
+        uint32_t capacity;
+        uint32_t root;
+        uint32_t freeList;
+        uint32_t used;  // Slots handed out at least once
+        uint32_t sz;    // Written atomically, since `size` reads it unlocked
+        uint32_t dead;  // Set once a process died holding the lock
+        pthread_mutex_t lock;
+    };
+
+    struct NODE {
+        T value;
+        int priority;
+        uint32_t parent;  // For duplicates, the head of the chain
+        uint32_t left;    // Also links free slots
+        uint32_t right;
+        uint32_t link;    // Link to duplicates
+    };
+
+    HEADER* header;
+    NODE* nodes;
+    size_t bytes;
+
+    static size_t segmentBytes(size_t capacity) {
+        return sizeof(HEADER) + capacity * sizeof(NODE);
+    }
+
+    // Locks the segment. If a process died holding the mutex, marks the
+    // segment broken. Returns false, without holding the lock, if the
+    // segment is not mapped or broken, or the mutex cannot be locked.
+    bool lock() const {
+        if (header == nullptr) {
+            return false;
+        }
+        int rc = pthread_mutex_lock(&header->lock);
+        if (rc == EOWNERDEAD) {
+            __atomic_store_n(&header->dead, 1, __ATOMIC_RELAXED);
+            pthread_mutex_consistent(&header->lock);
+        }
+        else if (rc != 0) {
+            return false;
+        }
+        if (header->dead) {
+            pthread_mutex_unlock(&header->lock);
+            return false;
+        }
+        return true;
+    }
+
+    void unlock() const {
+        pthread_mutex_unlock(&header->lock);
+    }
+
+    // Unlocks the segment when it goes out of scope, so that an exception
+    // cannot leave it locked for every process.
+    struct GUARD {
+        const shm_prqueue* queue;
+
+        ~GUARD() {
+            queue->unlock();
+        }
+    };
+
+    uint32_t allocNode(const T& value, int priority, uint32_t parent) {
+        uint32_t index = header->freeList;
+        if (index != NIL) {
+            header->freeList = nodes[index].left;
+        }
+        else {
+            index = header->used++;
+        }
+        NODE& node = nodes[index];
+        node.value = value;
+        node.priority = priority;
+        node.parent = parent;
+        node.left = NIL;
+        node.right = NIL;
+        node.link = NIL;
+        return index;
+    }
+
+    void freeNode(uint32_t index) {
+        nodes[index].left = header->freeList;
+        header->freeList = index;
+    }
+
+    uint32_t leftmost(uint32_t index) const {
+        while (nodes[index].left != NIL) {
+            index = nodes[index].left;
+        }
+        return index;
+    }
+
+    // Removes the value in the smallest node. Must hold the lock, and the
+    // tree must not be empty.
+    void removeFirst() {
+        uint32_t current = leftmost(header->root);
+
+        // If has dupes, the first one's value moves into the head
+        uint32_t dup = nodes[current].link;
+        if (dup != NIL) {
+            nodes[current].value = nodes[dup].value;
+            nodes[current].link = nodes[dup].link;
+            freeNode(dup);
+        }
+        else {
+            uint32_t parent = nodes[current].parent;
+            uint32_t child = nodes[current].right;
+            if (parent == NIL) {
+                header->root = child;
+            }
+            else {
+                nodes[parent].left = child;
+            }
+            if (child != NIL) {
+                nodes[child].parent = parent;
+            }
+            freeNode(current);
+        }
+        __atomic_fetch_sub(&header->sz, 1, __ATOMIC_RELAXED);
+    }
+
+   public:
+    /// Maps the shared-memory segment `name`, which must start with a `/`.
+    ///
+    /// With a `capacity` above 0, creates the segment with room for
+    /// `capacity` values, failing if it already exists. With a `capacity` of
+    /// 0, attaches to an existing segment created for the same `T`, which
+    /// fails if its creator has not finished setting it up, or if the
+    /// segment is smaller than its header says.
+    ///
+    /// Check `ok` before using the `shm_prqueue`.
+    ///
+    /// Runs in O(1), plus the time for the system to map the segment.
+    explicit shm_prqueue(const string& name, size_t capacity = 0) {
+        header = nullptr;
+        nodes = nullptr;
+        bytes = 0;
+        if (capacity >= NIL) {
+            return;
+        }
+
+        bool create = capacity > 0;
+        int fd = shm_open(name.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+        if (fd < 0) {
+            return;
+        }
+        if (create) {
+            bytes = segmentBytes(capacity);
+            if (ftruncate(fd, bytes) != 0) {
+                close(fd);
+                shm_unlink(name.c_str());
+                return;
+            }
+        }
+        else {
+            // A segment too short for what it claims to hold would fault on
+            // access instead of failing here
+            struct stat st;
+            if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(HEADER)) {
+                close(fd);
+                return;
+            }
+
+            // Map the header first to learn the size
+            void* mapped = mmap(nullptr, sizeof(HEADER), PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                return;
+            }
+            const HEADER* seen = static_cast<const HEADER*>(mapped);
+            bool valid = __atomic_load_n(&seen->magic, __ATOMIC_ACQUIRE) == MAGIC && seen->valueSize == sizeof(T) &&
+                         seen->capacity < NIL && segmentBytes(seen->capacity) <= static_cast<size_t>(st.st_size);
+            bytes = segmentBytes(seen->capacity);
+            munmap(mapped, sizeof(HEADER));
+            if (!valid) {
+                close(fd);
+                bytes = 0;
+                return;
+            }
+        }
+
+        void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            if (create) {
+                shm_unlink(name.c_str());
+            }
+            bytes = 0;
+            return;
+        }
+        header = static_cast<HEADER*>(mapped);
+        nodes = reinterpret_cast<NODE*>(static_cast<char*>(mapped) + sizeof(HEADER));
+
+        if (create) {
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+            pthread_mutex_init(&header->lock, &attr);
+            pthread_mutexattr_destroy(&attr);
+
+            header->valueSize = sizeof(T);
+            header->capacity = static_cast<uint32_t>(capacity);
+            header->root = NIL;
+            header->freeList = NIL;
+            header->used = 0;
+            __atomic_store_n(&header->sz, 0, __ATOMIC_RELAXED);
+            header->dead = 0;
+
+            // Set the magic last, so attaching processes see a finished header
+            __atomic_store_n(&header->magic, MAGIC, __ATOMIC_RELEASE);
+        }
+    }
+
+    shm_prqueue(const shm_prqueue&) = delete;
+    shm_prqueue& operator=(const shm_prqueue&) = delete;
+
+    /// Unmaps the segment. The segment itself stays until `remove`.
+    ~shm_prqueue() {
+        if (header != nullptr) {
+            munmap(header, bytes);
+        }
+    }
+
+    /// Removes the shared-memory segment `name`. Processes that have it
+    /// mapped keep using it until they unmap it. Returns true on success.
+    static bool remove(const string& name) {
+        return shm_unlink(name.c_str()) == 0;
+    }
+
+    /// Returns true if the segment was created or attached.
+    bool ok() const {
+        return header != nullptr;
+    }
+
+    /// Returns true if a process died while holding the segment's lock. Its
+    /// operation may have left the tree inconsistent, so every operation
+    /// on a broken segment fails, and it must be removed and created again.
+    ///
+    /// An operation that returns false on a segment that is not broken
+    /// failed for its usual reason: a full or empty `shm_prqueue`.
+    ///
+    /// Returns false if the segment was never mapped; see `ok`.
+    ///
+    /// Runs in O(1).
+    bool broken() const {
+        return header != nullptr && __atomic_load_n(&header->dead, __ATOMIC_RELAXED) != 0;
+    }
+
+    /// Adds `value` to the `shm_prqueue` with the given `priority`, writing
+    /// it directly into shared memory. Returns false, leaving the
+    /// `shm_prqueue` unchanged, if it is full or `broken`.
+    ///
+    /// Runs in O(H + M), where H is the height of the tree, and M is
+    /// the number of duplicate priorities.
+    bool enqueue(const T& value, int priority) {
+        if (!lock()) {
+            return false;
+        }
+        GUARD guard{this};
+        if (header->sz == header->capacity) {
+            return false;
+        }
+        __atomic_fetch_add(&header->sz, 1, __ATOMIC_RELAXED);
+
+        if (header->root == NIL) {
+            header->root = allocNode(value, priority, NIL);
+            return true;
+        }
+
+        uint32_t current = header->root;
+        while (true) {
+            if (priority == nodes[current].priority) {
+                uint32_t head = current;
+                while (nodes[current].link != NIL) {
+                    current = nodes[current].link;
+                }
+                nodes[current].link = allocNode(value, priority, head);
+                break;
+            }
+            else if (priority < nodes[current].priority) {
+                if (nodes[current].left == NIL) {
+                    nodes[current].left = allocNode(value, priority, current);
+                    break;
+                }
+                current = nodes[current].left;
+            }
+            else {
+                if (nodes[current].right == NIL) {
+                    nodes[current].right = allocNode(value, priority, current);
+                    break;
+                }
+                current = nodes[current].right;
+            }
+        }
+        return true;
+    }
+
+    /// Sets `value` and `priority` to the value with the smallest priority
+    /// and its priority, but does not remove it. Returns false if the
+    /// `shm_prqueue` is empty or `broken`.
+    ///
+    /// Runs in O(H), where H is the height of the tree.
+    bool peek(T& value, int& priority) const {
+        if (!lock()) {
+            return false;
+        }
+        GUARD guard{this};
+        if (header->root == NIL) {
+            return false;
+        }
+        const NODE& node = nodes[leftmost(header->root)];
+        value = node.value;
+        priority = node.priority;
+        return true;
+    }
+
+    /// Removes the value with the smallest priority, and returns it in
+    /// `value` along with its priority. Returns false if the `shm_prqueue`
+    /// is empty or `broken`.
+    ///
+    /// Runs in O(H), where H is the height of the tree.
+    bool dequeue(T& value, int& priority) {
+        return consume([&](const T& shared, int p) {
+            value = shared;
+            priority = p;
+        });
+    }
+
+    /// Calls `fn(value, priority)` on the value with the smallest priority
+    /// while it is still in shared memory, then removes it. Returns false,
+    /// without calling `fn`, if the `shm_prqueue` is empty or `broken`.
+    ///
+    /// The lock is held while `fn` runs, so it should be short, and must
+    /// not call back into the `shm_prqueue`. If `fn` throws, the lock is
+    /// released and the value stays in the `shm_prqueue`.
+    ///
+    /// Runs in O(H), where H is the height of the tree, plus the time `fn`
+    /// takes.
+    template <typename Fn>
+    bool consume(Fn fn) {
+        if (!lock()) {
+            return false;
+        }
+        GUARD guard{this};
+        if (header->root == NIL) {
+            return false;
+        }
+        const NODE& node = nodes[leftmost(header->root)];
+        fn(node.value, node.priority);
+        removeFirst();
+        return true;
+    }
+
+    /// Returns the number of elements in the `shm_prqueue`, or 0 if it is
+    /// not `ok`. Reads without the lock, so it may lag behind other
+    /// processes.
+    ///
+    /// Runs in O(1).
+    size_t size() const {
+        if (header == nullptr) {
+            return 0;
+        }
+        return __atomic_load_n(&header->sz, __ATOMIC_RELAXED);
+    }
+
+    /// Returns the maximum number of elements, or 0 if the `shm_prqueue` is
+    /// not `ok`.
+    ///
+    /// Runs in O(1).
+    size_t capacity() const {
+        if (header == nullptr) {
+            return 0;
+        }
+        return header->capacity;
+    }
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>  // For as_string
+
+using namespace std;
+
+/// A fixed-capacity version of `prqueue` that never allocates.
+///
+/// Storage for `N` values, duplicates included, lives inside the object,
+/// and nodes link to each other by 32-bit indices into it. `enqueue`
+/// returns false when all `N` slots are in use; slots freed by `dequeue`
+/// are reused.
+///
+/// Everything except `as_string` is `constexpr`, so a `static_prqueue` of a
+/// trivially copyable `T` can be filled and drained at compile time.
+///
+/// Unlike `prqueue`, the tree is never rebalanced; with a fixed capacity of
+/// `N`, it is at most `N` nodes deep.
+template <typename T, size_t N>
+class static_prqueue {
+    static_assert(N > 0 && N < UINT32_MAX, "capacity must fit in a 32-bit index");
+
+   private:
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct NODE {
+        T value{};
+        int priority = 0;
+        uint32_t parent = NIL;  // For duplicates, the head of the chain
+        uint32_t left = NIL;    // Also links free slots
+        uint32_t right = NIL;
+        uint32_t link = NIL;    // Link to duplicates
+    };
+
+    NODE nodes[N];
+    uint32_t root;
+    uint32_t freeList;
+    uint32_t used;  // Slots handed out at least once
+    uint32_t sz;
+
+    // Utility index for begin and next.
+    uint32_t curr;
+
+    constexpr uint32_t allocNode(const T& value, int priority, uint32_t parent) {
+        uint32_t index = freeList;
+        if (index != NIL) {
+            freeList = nodes[index].left;
+        }
+        else {
+            index = used++;
+        }
+        nodes[index] = NODE{value, priority, parent, NIL, NIL, NIL};
+        return index;
+    }
+
+    constexpr void freeNode(uint32_t index) {
+        nodes[index].left = freeList;
+        freeList = index;
+    }
+
+    constexpr uint32_t leftmost(uint32_t index) const {
+        while (nodes[index].left != NIL) {
+            index = nodes[index].left;
+        }
+        return index;
+    }
+
+    // Returns the in-order successor of a tree node, or NIL.
+    constexpr uint32_t successor(uint32_t index) const {
+        if (nodes[index].right != NIL) {
+            return leftmost(nodes[index].right);
+        }
+        uint32_t parent = nodes[index].parent;
+        while (parent != NIL && nodes[parent].right == index) {
+            index = parent;
+            parent = nodes[index].parent;
+        }
+        return parent;
+    }
+
+   public:
+    /// Creates an empty `static_prqueue`.
+    /// Runs in O(N), where N is the capacity, to initialize the storage.
+    constexpr static_prqueue() {
+        root = NIL;
+        freeList = NIL;
+        used = 0;
+        sz = 0;
+        curr = NIL;
+    }
+
+    /// Empties the `static_prqueue`.
+    ///
+    /// Runs in O(1).
+    constexpr void clear() {
+        root = NIL;
+        freeList = NIL;
+        used = 0;
+        sz = 0;
+        curr = NIL;
+    }
+
+    /// Adds `value` to the `static_prqueue` with the given `priority`.
+    /// Returns false, leaving the `static_prqueue` unchanged, if it is full.
+    ///
+    /// Runs in O(H + M), where H is the height of the tree, and M is
+    /// the number of duplicate priorities.
+    constexpr bool enqueue(T value, int priority) {
+        if (sz == N) {
+            return false;
+        }
+        sz++;
+
+        if (root == NIL) {
+            root = allocNode(value, priority, NIL);
+            return true;
+        }
+
+        uint32_t current = root;
+        while (true) {
+            if (priority == nodes[current].priority) {
+                uint32_t head = current;
+                while (nodes[current].link != NIL) {
+                    current = nodes[current].link;
+                }
+                nodes[current].link = allocNode(value, priority, head);
+                return true;
+            }
+            else if (priority < nodes[current].priority) {
+                if (nodes[current].left == NIL) {
+                    nodes[current].left = allocNode(value, priority, current);
+                    return true;
+                }
+                current = nodes[current].left;
+            }
+            else {
+                if (nodes[current].right == NIL) {
+                    nodes[current].right = allocNode(value, priority, current);
+                    return true;
+                }
+                current = nodes[current].right;
+            }
+        }
+    }
+
+    /// Returns the value with the smallest priority in the `static_prqueue`,
+    /// but does not modify it.
+    ///
+    /// If the `static_prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in O(H), where H is the height of the tree.
+    constexpr T peek() const {
+        if (root == NIL) {
+            return T{};
+        }
+        return nodes[leftmost(root)].value;
+    }
+
+    /// Returns the value with the smallest priority in the `static_prqueue`
+    /// and removes it.
+    ///
+    /// If the `static_prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in O(H), where H is the height of the tree.
+    constexpr T dequeue() {
+        if (root == NIL) {
+            return T();
+        }
+
+        uint32_t current = leftmost(root);
+        T result = nodes[current].value;
+
+        // If has dupes, the first one's value moves into the head
+        uint32_t dup = nodes[current].link;
+        if (dup != NIL) {
+            nodes[current].value = nodes[dup].value;
+            nodes[current].link = nodes[dup].link;
+            freeNode(dup);
+        }
+        else {
+            uint32_t parent = nodes[current].parent;
+            uint32_t child = nodes[current].right;
+            if (parent == NIL) {
+                root = child;
+            }
+            else {
+                nodes[parent].left = child;
+            }
+            if (child != NIL) {
+                nodes[child].parent = parent;
+            }
+            freeNode(current);
+        }
+        sz--;
+        return result;
+    }
+
+    /// Returns the number of elements in the `static_prqueue`.
+    ///
+    /// Runs in O(1).
+    constexpr size_t size() const {
+        return sz;
+    }
+
+    /// Returns the maximum number of elements, `N`.
+    ///
+    /// Runs in O(1).
+    static constexpr size_t capacity() {
+        return N;
+    }
+
+    /// Resets internal state for an iterative inorder traversal.
+    ///
+    /// See `next` for usage details.
+    ///
+    /// O(H), where H is the maximum height of the tree.
+    constexpr void begin() {
+        curr = (root == NIL) ? NIL : leftmost(root);
+    }
+
+    /// Uses the internal state to return the next in-order value and priority
+    /// by reference, and advances the internal state. Returns true if the
+    /// reference parameters were set, and false otherwise.
+    ///
+    /// Runs in worst-case O(H), where H is the height of the tree.
+    constexpr bool next(T& value, int& priority) {
+        if (curr == NIL) {
+            return false;
+        }
+        value = nodes[curr].value;
+        priority = nodes[curr].priority;
+
+        if (nodes[curr].link != NIL) {
+            curr = nodes[curr].link;
+            return true;
+        }
+
+        // Only a duplicate shares its parent's priority
+        uint32_t parent = nodes[curr].parent;
+        uint32_t head = (parent != NIL && nodes[parent].priority == priority) ? parent : curr;
+        curr = successor(head);
+        return true;
+    }
+
+    /// Converts the `static_prqueue` to a string representation, with the
+    /// values in-order by priority, in the same format as `prqueue`.
+    ///
+    /// Runs in O(N), where N is the number of values.
+    string as_string() const {
+        ostringstream output;
+        if (root == NIL) {
+            return output.str();
+        }
+        for (uint32_t index = leftmost(root); index != NIL; index = successor(index)) {
+            for (uint32_t dup = index; dup != NIL; dup = nodes[dup].link) {
+                output << nodes[index].priority << " value: " << nodes[dup].value << endl;
+            }
+        }
+        return output.str();
+    }
+};
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>      // For stable_sort
+#include <bit>            // For countl_zero and countr_zero
+#include <cstdint>
+#include <unordered_map>  // For cancellation by id
+#include <vector>
+
+using namespace std;
+
+/// A priority queue for timers, where the priority of each value is the tick
+/// at which it expires.
+///
+/// Values are kept in a hierarchical timing wheel: six levels of 64 slots,
+/// where level L holds timers that expire within the next 64^(L+1) ticks.
+/// Enqueue and cancel run in O(1), and `advance_to` fires expired timers in
+/// amortized O(1) each, cascading timers from a slot of level L down into
+/// level L - 1 as the current tick reaches it. Each slot keeps its timers
+/// in the order they were added, so timers with the same tick fire, peek
+/// and dequeue first-in, first-out.
+///
+/// `enqueue`, `peek` and `dequeue` behave like they do on `prqueue`, so a
+/// `timer_prqueue` can be used in its place without a clock.
+template <typename T>
+class timer_prqueue {
+   private:
+    static const int LEVEL_BITS = 6;
+    static const int SLOTS = 1 << LEVEL_BITS;
+    static const int LEVELS = 6;  // 6 * 6 bits cover every 32-bit tick
+
+    struct NODE {
+        int priority;
+        T value;
+        size_t id;
+        int level;  // -1 for the list of due timers
+        int slot;
+        NODE* prev;
+        NODE* next;
+    };
+
+    struct SLOT {
+        NODE* head;
+        NODE* tail;
+    };
+
+    SLOT wheel[LEVELS][SLOTS];
+    uint64_t occupied[LEVELS];  // Bit s is set if wheel[L][s] is not empty
+    SLOT due;                   // Timers that expire at or before `current`
+
+    uint32_t current;  // The current tick, as a key
+    size_t sz;
+    size_t nextId;
+    unordered_map<size_t, NODE*> ids;
+
+    // Maps a tick to an unsigned key with the same ordering.
+    static uint32_t toKey(int tick) {
+        return static_cast<uint32_t>(tick) ^ 0x80000000u;
+    }
+
+    static int toTick(uint32_t key) {
+        return static_cast<int>(key ^ 0x80000000u);
+    }
+
+    SLOT& slotOf(NODE* node) {
+        return node->level < 0 ? due : wheel[node->level][node->slot];
+    }
+
+    // Adds a timer to a slot, keeping the slot in the order the timers were
+    // added, so ties stay first-in, first-out. A new timer goes at the
+    // tail; a cascaded one goes behind the older timers already there.
+    void link(NODE* node, int level, int slot) {
+        node->level = level;
+        node->slot = slot;
+
+        SLOT& s = slotOf(node);
+        NODE* before = s.tail;
+        while (before != nullptr && before->id > node->id) {
+            before = before->prev;
+        }
+        node->prev = before;
+        node->next = before != nullptr ? before->next : s.head;
+        if (before != nullptr) {
+            before->next = node;
+        }
+        else {
+            s.head = node;
+        }
+        if (node->next != nullptr) {
+            node->next->prev = node;
+        }
+        else {
+            s.tail = node;
+        }
+
+        if (level >= 0) {
+            occupied[level] |= uint64_t(1) << slot;
+        }
+    }
+
+    void unlink(NODE* node) {
+        SLOT& s = slotOf(node);
+        if (node->prev != nullptr) {
+            node->prev->next = node->next;
+        }
+        else {
+            s.head = node->next;
+        }
+        if (node->next != nullptr) {
+            node->next->prev = node->prev;
+        }
+        else {
+            s.tail = node->prev;
+        }
+
+        if (node->level >= 0 && s.head == nullptr) {
+            occupied[node->level] &= ~(uint64_t(1) << node->slot);
+        }
+    }
+
+    // Files a timer by the highest bit in which its tick differs from the
+    // current tick, or into the due list if it has already expired.
+    void place(NODE* node) {
+        uint32_t key = toKey(node->priority);
+        if (key <= current) {
+            link(node, -1, 0);
+            return;
+        }
+
+        int level = (31 - countl_zero(key ^ current)) / LEVEL_BITS;
+        int slot = (key >> (level * LEVEL_BITS)) & (SLOTS - 1);
+        link(node, level, slot);
+    }
+
+    // Finds the lowest level with an occupied slot ahead of the current
+    // tick. Every timer in that slot expires before any other timer on the
+    // wheel. Returns false if the wheel is empty.
+    bool nextSlot(int& level, int& slot, uint64_t& start) const {
+        for (int l = 0; l < LEVELS; l++) {
+            int shift = l * LEVEL_BITS;
+            int index = (current >> shift) & (SLOTS - 1);
+            uint64_t ahead = index == SLOTS - 1 ? 0 : occupied[l] & (~uint64_t(0) << (index + 1));
+            if (ahead != 0) {
+                level = l;
+                slot = countr_zero(ahead);
+                uint64_t base = (uint64_t(current) >> (shift + LEVEL_BITS)) << (shift + LEVEL_BITS);
+                start = base | (uint64_t(slot) << shift);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Returns the earliest timer, preferring the first added among ties.
+    NODE* earliest() const {
+        NODE* node = due.head;
+        if (node == nullptr) {
+            int level;
+            int slot;
+            uint64_t start;
+            if (!nextSlot(level, slot, start)) {
+                return nullptr;
+            }
+            node = wheel[level][slot].head;
+        }
+
+        NODE* best = node;
+        for (; node != nullptr; node = node->next) {
+            if (node->priority < best->priority) {
+                best = node;
+            }
+        }
+        return best;
+    }
+
+    void release(NODE* node) {
+        ids.erase(node->id);
+        delete node;
+        sz--;
+    }
+
+    // Fires due timers that expire at or before `limit`, in tick order.
+    void fireDue(uint32_t limit, vector<T>& out) {
+        vector<NODE*> fired;
+        for (NODE* node = due.head; node != nullptr; node = node->next) {
+            if (toKey(node->priority) <= limit) {
+                fired.push_back(node);
+            }
+        }
+        stable_sort(fired.begin(), fired.end(), [](const NODE* a, const NODE* b) {
+            return a->priority < b->priority;
+        });
+
+        for (NODE* node : fired) {
+            unlink(node);
+            out.push_back(std::move(node->value));
+            release(node);
+        }
+    }
+
+   public:
+    /// Creates an empty `timer_prqueue` whose current tick is `start`.
+    /// Runs in O(1).
+    explicit timer_prqueue(int start = 0) {
+        for (int l = 0; l < LEVELS; l++) {
+            for (int s = 0; s < SLOTS; s++) {
+                wheel[l][s] = SLOT{nullptr, nullptr};
+            }
+            occupied[l] = 0;
+        }
+        due = SLOT{nullptr, nullptr};
+        current = toKey(start);
+        sz = 0;
+        nextId = 0;
+    }
+
+    timer_prqueue(const timer_prqueue&) = delete;
+    timer_prqueue& operator=(const timer_prqueue&) = delete;
+
+    /// Destructor, cleans up all memory associated with `timer_prqueue`.
+    ///
+    /// Runs in O(N), where N is the number of timers.
+    ~timer_prqueue() {
+        clear();
+    }
+
+    /// Cancels every timer, freeing all memory it controls. The current tick
+    /// is unchanged.
+    ///
+    /// Runs in O(N), where N is the number of timers.
+    void clear() {
+        for (auto& entry : ids) {
+            delete entry.second;
+        }
+        ids.clear();
+        for (int l = 0; l < LEVELS; l++) {
+            for (int s = 0; s < SLOTS; s++) {
+                wheel[l][s] = SLOT{nullptr, nullptr};
+            }
+            occupied[l] = 0;
+        }
+        due = SLOT{nullptr, nullptr};
+        sz = 0;
+    }
+
+    /// Adds `value` as a timer that expires at tick `priority`, and returns
+    /// an id that can be passed to `cancel`. A timer whose tick is not after
+    /// the current tick is due immediately.
+    ///
+    /// Runs in O(1).
+    size_t enqueue(T value, int priority) {
+        NODE* newNode = new NODE;
+        newNode->priority = priority;
+        newNode->value = value;
+        newNode->id = nextId++;
+        place(newNode);
+
+        ids[newNode->id] = newNode;
+        sz++;
+        return newNode->id;
+    }
+
+    /// Removes the timer with the given `id`. Returns true if it was found,
+    /// and false if it has already fired, been dequeued or been cancelled.
+    ///
+    /// Runs in O(1).
+    bool cancel(size_t id) {
+        auto found = ids.find(id);
+        if (found == ids.end()) {
+            return false;
+        }
+        unlink(found->second);
+        release(found->second);
+        return true;
+    }
+
+    /// Moves the current tick forward to `tick`, appending the values of all
+    /// timers that expire at or before it to `out`, in tick order. The
+    /// current tick never moves backwards. Returns the number of values
+    /// appended.
+    ///
+    /// Runs in amortized O(1) per fired timer, plus O(L) for each occupied
+    /// slot passed, where L is the number of levels.
+    size_t advance_to(int tick, vector<T>& out) {
+        size_t before = out.size();
+        uint32_t target = toKey(tick);
+        fireDue(target, out);
+
+        int level;
+        int slot;
+        uint64_t start;
+        while (nextSlot(level, slot, start) && start <= target) {
+            current = static_cast<uint32_t>(start);
+
+            NODE* node = wheel[level][slot].head;
+            wheel[level][slot] = SLOT{nullptr, nullptr};
+            occupied[level] &= ~(uint64_t(1) << slot);
+
+            // Every timer in a level 0 slot expires at its start, while the
+            // timers of higher levels cascade down to where they now belong
+            while (node != nullptr) {
+                NODE* next = node->next;
+                if (level == 0) {
+                    out.push_back(std::move(node->value));
+                    release(node);
+                }
+                else {
+                    place(node);
+                }
+                node = next;
+            }
+            fireDue(current, out);
+        }
+
+        if (target > current) {
+            current = target;
+        }
+        return out.size() - before;
+    }
+
+    /// Returns the current tick.
+    ///
+    /// Runs in O(1).
+    int now() const {
+        return toTick(current);
+    }
+
+    /// Returns the value of the earliest timer, but does not modify the
+    /// `timer_prqueue`.
+    ///
+    /// If the `timer_prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in O(L + S), where L is the number of levels and S is the number
+    /// of timers sharing the earliest slot.
+    T peek() const {
+        NODE* node = earliest();
+        if (node == nullptr) {
+            return T{};
+        }
+        return node->value;
+    }
+
+    /// Returns the value of the earliest timer and removes it, without
+    /// moving the current tick.
+    ///
+    /// If the `timer_prqueue` is empty, returns the default value for `T`.
+    ///
+    /// Runs in O(L + S), where L is the number of levels and S is the number
+    /// of timers sharing the earliest slot.
+    T dequeue() {
+        NODE* node = earliest();
+        if (node == nullptr) {
+            return T();
+        }
+        unlink(node);
+        T result = std::move(node->value);
+        release(node);
+        return result;
+    }
+
+    /// Returns the number of pending timers.
+    ///
+    /// Runs in O(1).
+    size_t size() const {
+        return sz;
+    }
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <atomic>
+#include <climits>  // For INT_MAX
+#include <memory>   // For unique_ptr
+#include <mutex>
+#include <utility>  // For pair
+#include <vector>
+
+#include "prqueue.h"
+
+/// A pool of per-worker `prqueue`s with work stealing.
+///
+/// Each worker enqueues and dequeues on its own shard, whose lock is only
+/// contended while another worker steals from it, and which sits on its own
+/// cache line. A worker whose shard is empty steals half of another shard:
+/// the half with the largest priorities, which its owner would reach last.
+/// The half is detached with `prqueue::split`, so no values are copied out
+/// of the victim.
+///
+/// `approx_min` and `size` read per-shard summaries without locking, so
+/// they may lag behind concurrent operations.
+template <typename T>
+class work_stealing_prqueue {
+   private:
+    struct alignas(64) SHARD {
+        mutex lock;
+        prqueue<T> items;
+
+        // Summaries for other threads, updated under `lock`.
+        atomic<size_t> size{0};
+        atomic<int> minPriority{INT_MAX};  // Meaningless while `size` is 0
+
+        // Values with priority `minPriority`, so the smallest priority only
+        // has to be looked up again once they are gone. Guarded by `lock`.
+        size_t minCount = 0;
+
+        // Updates the summaries after a value with `priority` was added.
+        // Must hold `lock`.
+        void added(int priority) {
+            int current = minPriority.load(memory_order_relaxed);
+            if (minCount == 0 || priority < current) {
+                minPriority.store(priority, memory_order_relaxed);
+                minCount = 1;
+            }
+            else if (priority == current) {
+                minCount++;
+            }
+            size.store(items.size(), memory_order_release);
+        }
+
+        // Updates the summaries after the smallest value was removed. Must
+        // hold `lock`.
+        void removed() {
+            if (--minCount == 0) {
+                publish();
+                return;
+            }
+            size.store(items.size(), memory_order_release);
+        }
+
+        // Reads the summaries from `items` again. Must hold `lock`.
+        void publish() {
+            T value;
+            int priority;
+            minCount = 0;
+            if (items.peek(value, priority)) {
+                minPriority.store(priority, memory_order_relaxed);
+                minCount = items.count_priority(priority);
+            }
+            size.store(items.size(), memory_order_release);
+        }
+    };
+
+    vector<unique_ptr<SHARD>> shards;
+
+    atomic<size_t> attempts{0};
+    atomic<size_t> steals{0};
+    atomic<size_t> stolen{0};
+
+   public:
+    /// Counters describing the stealing done by a `work_stealing_prqueue`.
+    struct steal_stats {
+        size_t attempts;  // Calls to `steal`
+        size_t steals;    // Calls to `steal` that moved values
+        size_t stolen;    // Values moved by all steals
+    };
+
+    /// Creates a pool of `workers` empty shards, numbered from 0.
+    /// Runs in O(W), where W is the number of workers.
+    explicit work_stealing_prqueue(size_t workers) {
+        for (size_t i = 0; i < workers; i++) {
+            shards.push_back(make_unique<SHARD>());
+        }
+    }
+
+    work_stealing_prqueue(const work_stealing_prqueue&) = delete;
+    work_stealing_prqueue& operator=(const work_stealing_prqueue&) = delete;
+
+    /// Adds `value` with the given `priority` to the shard of `worker`.
+    ///
+    /// Runs in O(H + M), where H is the height of the shard's tree, and M is
+    /// the number of duplicate priorities. The shard's published summary is
+    /// updated in O(1).
+    void enqueue(size_t worker, T value, int priority) {
+        SHARD& shard = *shards[worker];
+        lock_guard<mutex> guard(shard.lock);
+        shard.items.enqueue(value, priority);
+        shard.added(priority);
+    }
+
+    /// Removes the value with the smallest priority from the shard of
+    /// `worker` into `value`. If the shard is empty, first tries to `steal`
+    /// for it. Returns false if no value was found.
+    ///
+    /// Runs in O(H + M) when the shard is not empty. The shard's smallest
+    /// priority is only looked up again, in O(H), once its last value with
+    /// the old one is removed.
+    bool dequeue(size_t worker, T& value) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            SHARD& shard = *shards[worker];
+            {
+                lock_guard<mutex> guard(shard.lock);
+                if (shard.items.size() > 0) {
+                    value = shard.items.dequeue();
+                    shard.removed();
+                    return true;
+                }
+            }
+            if (attempt == 0 && steal(worker) == 0) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    /// Moves half of the values of the fullest other shard, those with the
+    /// largest priorities, into the shard of `thief`. A shard with a single
+    /// value gives it up. Returns the number of values moved.
+    ///
+    /// Values that share the median priority stay together, so a shard of
+    /// several values that all have the same priority cannot be stolen from.
+    ///
+    /// The victim's values are read with `prqueue::peek_view`, so its
+    /// `begin`/`next` state is left alone.
+    ///
+    /// Runs in O(V + H + W), where V is the number of values in the victim,
+    /// H is the height of its tree, and W is the number of workers.
+    size_t steal(size_t thief) {
+        attempts.fetch_add(1, memory_order_relaxed);
+
+        size_t victim = thief;
+        size_t most = 0;
+        for (size_t i = 0; i < shards.size(); i++) {
+            size_t size = shards[i]->size.load(memory_order_acquire);
+            if (i != thief && size > most) {
+                victim = i;
+                most = size;
+            }
+        }
+        if (victim == thief) {
+            return 0;
+        }
+
+        prqueue<T> loot;
+        {
+            SHARD& shard = *shards[victim];
+            lock_guard<mutex> guard(shard.lock);
+            size_t keep = shard.items.size() / 2;
+            if (keep == 0) {
+                loot = std::move(shard.items);
+            }
+            else {
+                // Find the priority of the last value kept
+                T value;
+                int priority = 0;
+                auto cursor = shard.items.peek_view();
+                for (size_t i = 0; i < keep; i++) {
+                    cursor.next(value, priority);
+                }
+                loot = shard.items.split(priority);
+            }
+            shard.publish();
+        }
+        size_t count = loot.size();
+        if (count == 0) {
+            return 0;
+        }
+
+        SHARD& shard = *shards[thief];
+        {
+            lock_guard<mutex> guard(shard.lock);
+            if (shard.items.size() == 0) {
+                shard.items = std::move(loot);
+            }
+            else {
+                shard.items.enqueue_batch(std::move(loot).to_vector());
+            }
+            shard.publish();
+        }
+
+        steals.fetch_add(1, memory_order_relaxed);
+        stolen.fetch_add(count, memory_order_relaxed);
+        return count;
+    }
+
+    /// Sets `priority` to the smallest priority across all shards, as last
+    /// published by their owners. Returns false if every shard looked empty.
+    ///
+    /// Runs in O(W), where W is the number of workers.
+    bool approx_min(int& priority) const {
+        bool found = false;
+        for (const auto& shard : shards) {
+            if (shard->size.load(memory_order_acquire) == 0) {
+                continue;
+            }
+            int candidate = shard->minPriority.load(memory_order_relaxed);
+            if (!found || candidate < priority) {
+                priority = candidate;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    /// Returns the number of values across all shards, as last published by
+    /// their owners.
+    ///
+    /// Runs in O(W), where W is the number of workers.
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& shard : shards) {
+            total += shard->size.load(memory_order_acquire);
+        }
+        return total;
+    }
+
+    /// Returns the number of workers.
+    ///
+    /// Runs in O(1).
+    size_t workers() const {
+        return shards.size();
+    }
+
+    /// Returns the stealing counters.
+    ///
+    /// Runs in O(1).
+    steal_stats stats() const {
+        return steal_stats{attempts.load(memory_order_relaxed), steals.load(memory_order_relaxed),
+                           stolen.load(memory_order_relaxed)};
+    }
+};